@@ -3,7 +3,6 @@
 #include <map>
 #include <algorithm>
 #include <limits.h>
-#include <sys/time.h>
 #include <string>
 #include <string.h>
 #include <sstream>
@@ -11,9 +10,25 @@
 #include <set>
 #include <cstdio>
 #include <cstdlib>
+#include <cctype>
 #include <cmath>
 #include <stack>
 #include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -23,9 +38,6 @@ const int UNKNOWN = -1;
 const char WALL = 10;
 const char EMPTY = 11;
 
-int g_main_score = 1000;
-int g_sub_score = -500;
-
 const int DY[4] = {0, 1, 0, -1};
 const int DX[4] = {-1, 0, 1, 0};
 
@@ -33,27 +45,17 @@ const int DX[4] = {-1, 0, 1, 0};
 const int MAX_HEIGHT = 60;
 // 最大の横幅
 const int MAX_WIDTH = 60;
+// 番兵の壁の枠を含めた1行の最大のセル数
+const int MAX_STRIDE = MAX_WIDTH + 2;
+// 番兵の壁の枠を含めた最大のセル数
+const int MAX_CELL = (MAX_HEIGHT + 2) * MAX_STRIDE;
 // 取りうる状態数(zoblishで使う)
 const int MAX_STATUS = 12;
+// 1回のビームサーチで調べるボールの最大数
+const int MAX_SEARCH_BALL_COUNT = 20;
+// 転がしても目的地に届かないことを表す距離
+const unsigned char UNREACHABLE = 255;
 
-// ビーム幅
-int g_beam_range;
-// 探索の深さ
-int g_beam_depth;
-// 調べるボールの数
-int g_search_ball_count;
-
-// 高さ
-int g_height;
-// 横幅
-int g_width;
-// ボールの総数
-int g_total_ball_count;
-// ボールの種類の数
-int g_ball_type_count;
-// 滑る回数の上限
-int g_slip_limit = 4;
-int g_total_target_count;
 
 /**
  * 数値から文字列へ
@@ -66,15 +68,6 @@ inline string int2string(int number){
   return ss.str();
 }
 
-/**
- * z座標の取得
- * @param y y座標
- * @param x x座標
- * @return 1次元にした結果の座標
- */
-inline int getZ(int y, int x){
-  return (y * MAX_HEIGHT + x);
-}
 
 /**
  * 文字を数値に
@@ -143,151 +136,1541 @@ struct QUERY {
   }
 };
 
+// ビームサーチのノード
+// 盤面は持たずに探索対象のボールの位置だけを保持する
 struct NODE {
-  QUERY query;                      // ボールの操作
-  char maze[MAX_HEIGHT][MAX_WIDTH]; // 盤面
-  int eval;                         // 評価値
-  int score;                        // スコア
-  ll hash;                          // 盤面のハッシュ値
-
-  bool operator >(const NODE &e) const{
-    return score + eval < e.score + e.eval;
-  }   
+  int parent;                                       // 親ノードの番号(1つ前の深さでの添字)
+  QUERY query;                                      // 最初のボールの操作
+  unsigned char ball_y[MAX_SEARCH_BALL_COUNT];      // 探索対象のボールのy座標
+  unsigned char ball_x[MAX_SEARCH_BALL_COUNT];      // 探索対象のボールのx座標
+  int eval;                                         // 評価値
+  int score;                                        // スコア
+  ll hash;                                          // 盤面のハッシュ値
+
+  NODE(){
+    this->parent = UNKNOWN;
+    this->eval = 0;
+    this->score = 0;
+    this->hash = 0;
+  }
+};
+
+// ビームサーチの子ノードの候補(ビームに残ったものだけNODEにする)
+struct CANDIDATE {
+  int eval;               // 評価値
+  int score;              // スコア
+  ll hash;                // 盤面のハッシュ値
+  int parent;             // 親ノードの番号
+  int order;              // 候補をまとめた時の順番(評価値が同じ場合はこの順で選ぶ)
+  unsigned char index;    // 転がしたボールの探索対象の中での番号
+  unsigned char direct;   // 転がした方向
+  unsigned char to_y;     // 転がした後のy座標
+  unsigned char to_x;     // 転がした後のx座標
+
+  bool operator >(const CANDIDATE &e) const{
+    if(score + eval != e.score + e.eval) return score + eval > e.score + e.eval;
+    return order < e.order;
+  }
+};
+
+// 同じ色のボールと目標地点の最小費用の割当(ハンガリアン法)
+// 行がボール、列が目標地点で、数が合わない場合は費用0の仮の行(列)で正方行列にしている
+struct ASSIGNMENT {
+  int size;
+  vector<int> ball_ids;                 // 行に対応するボールのID
+  vector<int> target_ids;               // 列に対応する目標地点のID
+  vector< vector<int> > cost;           // 割当の費用(1-indexed)
+  vector<int> u;                        // 行のポテンシャル
+  vector<int> v;                        // 列のポテンシャル
+  vector<int> owner;                    // 列に割り当てられている行(0は未割当)
+  vector<int> way;
+  vector<int> min_value;
+  vector<char> used;
+  vector<int> rest_rows;                // 初期解で割り当てられなかった行
+
+  /**
+   * 割当の初期化
+   *   前の問題で確保した領域は大きさが足りる限りそのまま使う
+   * @param size 正方行列の大きさ
+   */
+  void init(int size){
+    this->size = size;
+    ball_ids.assign(size + 1, UNKNOWN);
+    target_ids.assign(size + 1, UNKNOWN);
+    if(cost.size() < size + 1) cost.resize(size + 1);
+    for(int row = 0; row <= size; row++){
+      cost[row].assign(size + 1, 0);
+    }
+    u.assign(size + 1, 0);
+    v.assign(size + 1, 0);
+    owner.assign(size + 1, 0);
+    way.assign(size + 1, 0);
+    min_value.assign(size + 1, 0);
+    used.assign(size + 1, false);
+  }
+
+  /**
+   * 全ての行の割当を求める
+   *   行と列の最小の費用をポテンシャルの初期値にして、被約費用が0の列が空いている行はそのまま割り当てる
+   *   (近い目標地点が重ならないボールが多いので、増加路を探す行が大きく減る)
+   */
+  void solve(){
+    fill(v.begin(), v.end(), 0);
+    fill(owner.begin(), owner.end(), 0);
+    rest_rows.clear();
+
+    for(int row = 1; row <= size; row++){
+      int min_col = 1;
+      for(int col = 2; col <= size; col++){
+        if(cost[row][col] < cost[row][min_col]) min_col = col;
+      }
+
+      u[row] = cost[row][min_col];
+      if(owner[min_col] == 0){
+        owner[min_col] = row;
+      }else{
+        rest_rows.push_back(row);
+      }
+    }
+
+    // 割り当て済みの列は被約費用が0の行があるので0のまま
+    for(int col = 1; col <= size; col++){
+      if(owner[col] != 0) continue;
+
+      int min_cost = INT_MAX;
+      for(int row = 1; row <= size; row++){
+        min_cost = min(min_cost, cost[row][col] - u[row]);
+      }
+      v[col] = min_cost;
+    }
+
+    for(int i = 0; i < rest_rows.size(); i++){
+      augment(rest_rows[i]);
+    }
+  }
+
+  /**
+   * 1行の費用が変わった時に割当を修正する
+   *   ポテンシャルを保ったまま、その行から増加路を1本だけ探す O(size^2)
+   * @param row 費用が変わった行
+   */
+  void update_row(int row){
+    for(int col = 1; col <= size; col++){
+      if(owner[col] == row) owner[col] = 0;
+    }
+
+    // 被約費用が負にならないように行のポテンシャルを下げる
+    int min_cost = INT_MAX;
+    for(int col = 1; col <= size; col++){
+      min_cost = min(min_cost, cost[row][col] - v[col]);
+    }
+    u[row] = min_cost;
+
+    augment(row);
+  }
+
+  /**
+   * 未割当の行から最短の増加路を探して割り当てる
+   * @param row 行
+   */
+  void augment(int row){
+    owner[0] = row;
+    int col = 0;
+    fill(min_value.begin(), min_value.end(), INT_MAX);
+    fill(used.begin(), used.end(), false);
+
+    do{
+      used[col] = true;
+      int cur_row = owner[col];
+      int delta = INT_MAX;
+      int next_col = 0;
+
+      for(int j = 1; j <= size; j++){
+        if(used[j]) continue;
+
+        int value = cost[cur_row][j] - u[cur_row] - v[j];
+        if(value < min_value[j]){
+          min_value[j] = value;
+          way[j] = col;
+        }
+        if(min_value[j] < delta){
+          delta = min_value[j];
+          next_col = j;
+        }
+      }
+
+      for(int j = 0; j <= size; j++){
+        if(used[j]){
+          u[owner[j]] += delta;
+          v[j] -= delta;
+        }else{
+          min_value[j] -= delta;
+        }
+      }
+
+      col = next_col;
+    }while(owner[col] != 0);
+
+    do{
+      int prev_col = way[col];
+      owner[col] = owner[prev_col];
+      col = prev_col;
+    }while(col != 0);
+  }
+};
+
+// 探索済みの盤面のハッシュ値を保存する集合(オープンアドレス法)
+// 世代番号を使うことでclearはO(1)で行える
+struct HASH_SET {
+  struct ENTRY {
+    ll key;
+    unsigned int stamp;
+  };
+
+  vector<ENTRY> entries;
+  unsigned int generation;
+  unsigned int mask;
+  unsigned int count;
+
+  HASH_SET(){
+    this->generation = 1;
+    this->mask = 0;
+    this->count = 0;
+  }
+
+  /**
+   * 最低でもsize個の要素が入るように領域を確保する
+   * @param size 要素数
+   */
+  void init(int size){
+    unsigned int capacity = 1;
+    // 負荷率が0.5以下になるようにする
+    while(capacity < 2 * (unsigned int)size) capacity <<= 1;
+
+    ENTRY entry = {0, 0};
+    entries.assign(capacity, entry);
+    mask = capacity - 1;
+    generation = 1;
+    count = 0;
+  }
+
+  /**
+   * 全ての要素を削除する
+   */
+  inline void clear(){
+    generation += 1;
+    count = 0;
+
+    // 世代番号が一周した場合は全て初期化する
+    if(generation == 0){
+      for(int i = 0; i < entries.size(); i++){
+        entries[i].stamp = 0;
+      }
+      generation = 1;
+    }
+  }
+
+  /**
+   * 要素が含まれているかどうかを調べる
+   * @param key zoblish hash
+   * @return (true: 含まれている, false: 含まれていない)
+   */
+  inline bool contains(ll key) const{
+    unsigned int index = (unsigned long long)key & mask;
+
+    while(entries[index].stamp == generation){
+      if(entries[index].key == key) return true;
+      index = (index + 1) & mask;
+    }
+
+    return false;
+  }
+
+  /**
+   * 要素を追加する
+   * @param key zoblish hash
+   * @return (true: 新しく追加された, false: 既に存在していた)
+   */
+  inline bool insert(ll key){
+    unsigned int index = (unsigned long long)key & mask;
+
+    while(entries[index].stamp == generation){
+      if(entries[index].key == key) return false;
+      index = (index + 1) & mask;
+    }
+
+    entries[index].key = key;
+    entries[index].stamp = generation;
+    count += 1;
+
+    // 負荷率が0.5を超えたら広げる
+    if(2 * count > entries.size()) grow();
+
+    return true;
+  }
+
+  /**
+   * 領域を2倍にして今の世代の要素を入れ直す
+   */
+  void grow(){
+    vector<ENTRY> old_entries;
+    old_entries.swap(entries);
+    unsigned int old_generation = generation;
+
+    init(old_entries.size());
+
+    for(int i = 0; i < old_entries.size(); i++){
+      if(old_entries[i].stamp == old_generation){
+        insert(old_entries[i].key);
+      }
+    }
+  }
+};
+
+// ボールの状態の分類(探索対象のボールを選ぶ時の優先度に使う)
+enum BALL_CLASS {
+  BALL_SETTLED,   // 同じ色の目標地点に乗っている
+  BALL_BLOCKING,  // 違う色の目標地点を塞いでいる
+  BALL_IN_PATH,   // 空いている目標地点と同じ壁の間の行か列にあり、そこへ転がすボールの道を塞いでいる
+  BALL_NEAR,      // 壁だけを考えると数回の転がしで同じ色の目標地点に届く
+  BALL_FAR,       // それ以外
+  BALL_CLASS_COUNT
+};
+
+// ボールを状態ごとの組に分けて持つ索引
+// 組の中の並び順は自由なので、組の移動と組の中からの抽選はO(1)で行える
+struct BALL_INDEX {
+  vector<int> members[BALL_CLASS_COUNT];
+  vector<int> ball_class;
+  vector<int> position;
+
+  /**
+   * 全てのボールを組から外す
+   * @param ball_count ボールの数
+   */
+  void init(int ball_count){
+    for(int i = 0; i < BALL_CLASS_COUNT; i++){
+      members[i].clear();
+    }
+    ball_class.assign(ball_count, UNKNOWN);
+    position.assign(ball_count, UNKNOWN);
+  }
+
+  /**
+   * ボールを指定した組に移す
+   * @param ball_id ボールのID
+   * @param new_class 移動先の組
+   */
+  inline void set(int ball_id, int new_class){
+    int old_class = ball_class[ball_id];
+    if(old_class == new_class) return;
+
+    if(old_class != UNKNOWN){
+      // 末尾のボールを空いた場所に詰める
+      vector<int> &list = members[old_class];
+      int last_id = list.back();
+      list[position[ball_id]] = last_id;
+      position[last_id] = position[ball_id];
+      list.pop_back();
+    }
+
+    ball_class[ball_id] = new_class;
+    position[ball_id] = members[new_class].size();
+    members[new_class].push_back(ball_id);
+  }
+
+  /**
+   * 組の中の2つのボールの位置を入れ替える
+   */
+  inline void swap_members(int cls, int i, int j){
+    vector<int> &list = members[cls];
+    swap(list[i], list[j]);
+    position[list[i]] = i;
+    position[list[j]] = j;
+  }
+};
+
+// ボールの位置をビットで管理する盤面
+// 行ごと(bitはx座標)と列ごと(bitはy座標)の両方を持つことで
+// 転がした先で最初にぶつかるボールをビット演算1回で求められる
+struct BITBOARD {
+  unsigned long long row[MAX_HEIGHT];
+  unsigned long long col[MAX_WIDTH];
+
+  /**
+   * 全てのボールを取り除く
+   */
+  void clear(){
+    memset(row, 0, sizeof(row));
+    memset(col, 0, sizeof(col));
+  }
+
+  /**
+   * ボールを置く
+   */
+  inline void set(int y, int x){
+    row[y] |= (1ULL << x);
+    col[x] |= (1ULL << y);
+  }
+
+  /**
+   * ボールを取り除く
+   */
+  inline void reset(int y, int x){
+    row[y] &= ~(1ULL << x);
+    col[x] &= ~(1ULL << y);
+  }
+
+  /**
+   * ボールを移動させる
+   */
+  inline void move(int y1, int x1, int y2, int x2){
+    reset(y1, x1);
+    set(y2, x2);
+  }
+};
+
+// ポートフォリオで同時に動かすソルバーごとの設定
+struct PORTFOLIO_PARAM {
+  int beam_range_percent;   // set_beam_config()で決めたビーム幅に掛ける割合(%)
+  int roll_distance_limit;  // 評価値をつける転がし回数の上限
+  int assignment_weight;    // 割り当てた目標地点に近づいた時の重み
+  int main_score;           // 同じ色のボールが目標地点にある時のスコア
+  int sub_score;            // 違う色のボールが目標地点にある時のスコア
+};
+
+// 0番目は呼び出し元の設定をそのまま使う(ビーム幅の割合以外の値は使わない)
+// ソルバーの数がこれより多い場合は乱数のシード値だけ変えて繰り返す
+const PORTFOLIO_PARAM PORTFOLIO_PARAM_LIST[] = {
+  {100, 4, 2, 1000, -500},
+  {100, 3, 2, 1000, -500},
+  {150, 4, 3, 1000, -500},
+  { 70, 5, 2, 1000, -300},
+  {100, 4, 1, 1000, -700},
+  {150, 5, 3, 1000, -500},
+  { 70, 3, 2, 1000, -500},
+  {100, 6, 2, 1000, -300},
+};
+const int PORTFOLIO_PARAM_COUNT = sizeof(PORTFOLIO_PARAM_LIST) / sizeof(PORTFOLIO_PARAM_LIST[0]);
+
+// 計測する処理の区間
+enum PHASE {
+  PHASE_INIT,     // 初期化(評価用の盤面の作成など)
+  PHASE_EXPAND,   // ビームサーチの展開
+  PHASE_SELECT,   // ビームサーチの候補の選択
+  PHASE_ROLL,     // 実際にボールを転がす
+  PHASE_COUNT
+};
+
+const char *PHASE_NAME[PHASE_COUNT] = {"init", "expand", "select", "roll"};
+
+// ハードウェアカウンタで計測するイベント
+enum PERF_EVENT {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_EVENT_COUNT
+};
+
+const char *PERF_EVENT_NAME[PERF_EVENT_COUNT] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+
+// ハードウェアカウンタの値
+struct PERF_VALUES {
+  ll value[PERF_EVENT_COUNT];
+
+  PERF_VALUES(){
+    memset(value, 0, sizeof(value));
+  }
+};
+
+// ハードウェアカウンタ(Linuxのperf_event_openを使う)
+// 呼び出したスレッドのユーザー空間の処理だけを数える
+// 使えないイベント(権限がない、仮想環境など)は値を-1にする
+class PERF_COUNTER {
+  public:
+    PERF_COUNTER(){
+      for(int event = 0; event < PERF_EVENT_COUNT; event++){
+        fd[event] = UNKNOWN;
+      }
+    }
+
+    ~PERF_COUNTER(){
+      close_all();
+    }
+
+    /**
+     * カウンタを開く
+     * @return (true: 1つ以上のイベントが使える, false: 全て使えない)
+     */
+    bool open_all(){
+      bool available = false;
+#ifdef __linux__
+      const unsigned int TYPE[PERF_EVENT_COUNT] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+      };
+      const unsigned long long CONFIG[PERF_EVENT_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_BRANCH_MISSES
+      };
+
+      close_all();
+
+      for(int event = 0; event < PERF_EVENT_COUNT; event++){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = TYPE[event];
+        attr.config = CONFIG[event];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fd[event] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if(fd[event] < 0){
+          fd[event] = UNKNOWN;
+        }else{
+          available = true;
+        }
+      }
+#endif
+      return available;
+    }
+
+    /**
+     * 現在の値を読み込む
+     * @param values 読み込んだ値(使えないイベントは-1)
+     */
+    void read_all(PERF_VALUES &values){
+      for(int event = 0; event < PERF_EVENT_COUNT; event++){
+        values.value[event] = UNKNOWN;
+#ifdef __linux__
+        ll count;
+        if(fd[event] != UNKNOWN && read(fd[event], &count, sizeof(count)) == sizeof(count)){
+          values.value[event] = count;
+        }
+#endif
+      }
+    }
+
+  private:
+    int fd[PERF_EVENT_COUNT];
+
+    void close_all(){
+      for(int event = 0; event < PERF_EVENT_COUNT; event++){
+#ifdef __linux__
+        if(fd[event] != UNKNOWN) close(fd[event]);
+#endif
+        fd[event] = UNKNOWN;
+      }
+    }
+};
+
+// ビームサーチの展開を行うスレッドごとの作業領域
+struct WORKER {
+  BITBOARD ball_bits;           // このスレッドで展開中の盤面のボールの位置
+  HASH_SET check_list;          // このスレッド内で生成した盤面のハッシュ値
+  vector<CANDIDATE> candidates; // このスレッドで生成した子ノードの候補
+  ll duplicate_count;           // このスレッドで見つけた重複した盤面の数
+  unique_ptr<PERF_COUNTER> perf_counter;  // このスレッドのハードウェアカウンタ(このスレッドで開く)
+  PERF_VALUES perf;             // 直前にrun_workers()で実行した分のハードウェアカウンタの値
+  int cell_queue[MAX_CELL];     // このスレッドで行うセルの幅優先探索のキュー
+};
+
+// 区間の開始時の状態
+struct PHASE_MARK {
+  chrono::steady_clock::time_point time;
+  PERF_VALUES perf;
+};
+
+// 探索の統計情報
+struct SEARCH_STATS {
+  ll generated_count;               // 生成したノードの数(重複を含む)
+  ll duplicate_count;               // 重複していたノードの数
+  ll kept_count;                    // ビームに残ったノードの数
+  double phase_time[PHASE_COUNT];   // 区間ごとの時間(ms)
+  PERF_VALUES phase_perf[PHASE_COUNT];  // 区間ごとのハードウェアカウンタの値
+
+  SEARCH_STATS(){
+    clear();
+  }
+
+  void clear(){
+    generated_count = 0;
+    duplicate_count = 0;
+    kept_count = 0;
+    for(int phase = 0; phase < PHASE_COUNT; phase++){
+      phase_time[phase] = 0.0;
+      phase_perf[phase] = PERF_VALUES();
+    }
+  }
+
+  void add(const SEARCH_STATS &stats){
+    generated_count += stats.generated_count;
+    duplicate_count += stats.duplicate_count;
+    kept_count += stats.kept_count;
+    for(int phase = 0; phase < PHASE_COUNT; phase++){
+      phase_time[phase] += stats.phase_time[phase];
+      for(int event = 0; event < PERF_EVENT_COUNT; event++){
+        phase_perf[phase].value[event] += stats.phase_perf[phase].value[event];
+      }
+    }
+  }
+
+  /**
+   * JSONの項目として書き出す
+   * @param with_init 初期化の時間も書き出すかどうか(1手ごとの統計情報では常に0なので書き出さない)
+   */
+  void write(FILE *out, bool with_init = true) const{
+    fprintf(out, "\"generated\": %lld, \"duplicated\": %lld, \"kept\": %lld, \"duplicate_rate\": %.4f",
+        generated_count, duplicate_count, kept_count, (generated_count > 0)? (double)duplicate_count / generated_count : 0.0);
+    for(int phase = 0; phase < PHASE_COUNT; phase++){
+      if(phase == PHASE_INIT && !with_init) continue;
+      fprintf(out, ", \"%s_ms\": %.3f", PHASE_NAME[phase], phase_time[phase]);
+    }
+  }
+
+  /**
+   * ハードウェアカウンタの値をJSONの項目として書き出す
+   * @param available カウンタが使えるかどうか(使えない場合はnullを書き出す)
+   */
+  void write_perf(FILE *out, bool available) const{
+    fprintf(out, "\"perf\": ");
+    if(!available){
+      fprintf(out, "null");
+      return;
+    }
+
+    fprintf(out, "{");
+    for(int phase = 0; phase < PHASE_COUNT; phase++){
+      fprintf(out, "%s\"%s\": {", (phase > 0)? ", " : "", PHASE_NAME[phase]);
+      for(int event = 0; event < PERF_EVENT_COUNT; event++){
+        ll value = phase_perf[phase].value[event];
+        if(value < 0){
+          fprintf(out, "%s\"%s\": null", (event > 0)? ", " : "", PERF_EVENT_NAME[event]);
+        }else{
+          fprintf(out, "%s\"%s\": %lld", (event > 0)? ", " : "", PERF_EVENT_NAME[event], value);
+        }
+      }
+      fprintf(out, "}");
+    }
+    fprintf(out, "}");
+  }
 };
 
-// 迷路
-char g_maze[MAX_HEIGHT][MAX_WIDTH];
-// 保存用の迷路
-char g_temp_maze[MAX_HEIGHT][MAX_WIDTH];
-// 一番最初の盤面を保存する用
-char g_origin_maze[MAX_HEIGHT][MAX_WIDTH];
-// 目標の盤面
-int g_target[MAX_HEIGHT][MAX_WIDTH];
-// 評価用の盤面
-int g_eval_field[MAX_HEIGHT][MAX_WIDTH][10];
-// ボールのリスト
-vector<BALL> g_ball_list;
-// 目標のリスト
-vector<TARGET> g_target_list;
-// zoblish hash作成用盤面
-ll g_zoblish_field[MAX_HEIGHT][MAX_WIDTH][MAX_STATUS];
-
-// 乱数生成
-unsigned long long xor128(){
-  static unsigned long long rx=123456789, ry=362436069, rz=521288629, rw=88675123;
-  unsigned long long rt = (rx ^ (rx<<11));
-  rx=ry; ry=rz; rz=rw;
-  return (rw=(rw^(rw>>19))^(rt^(rt>>8)));
+/**
+ * JSONの文字列に入れられるように特殊文字をエスケープする
+ * @param text 元の文字列
+ * @return エスケープした文字列(前後の"は付けない)
+ */
+string escape_json(const string &text){
+  string result;
+
+  for(int i = 0; i < text.size(); i++){
+    unsigned char c = text[i];
+
+    if(c == '"' || c == '\\'){
+      result += '\\';
+      result += c;
+    }else if(c < 0x20){
+      char code[8];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      result += code;
+    }else{
+      result += c;
+    }
+  }
+
+  return result;
+}
+
+/**
+ * 盤面の大きさの区分を取得する
+ * @param cell_count セルの数
+ * @return 区分の名前(small: 20x20以下, medium: 40x40以下, large: それ以上)
+ */
+inline const char *get_size_class(int cell_count){
+  if(cell_count <= 400) return "small";
+  if(cell_count <= 1600) return "medium";
+  return "large";
+}
+
+// 常駐するスレッドの集まり
+// run()に渡した関数を全てのスレッドで1回ずつ実行して終わるまで待つ
+class THREAD_POOL {
+  public:
+    THREAD_POOL(){
+      this->round = 0;
+      this->finished = 0;
+      this->stop = false;
+    }
+
+    ~THREAD_POOL(){
+      stop_all();
+    }
+
+    /**
+     * スレッドを起動する(呼び出し元のスレッドも0番目として使う)
+     * @param thread_count スレッド数
+     */
+    void start(int thread_count){
+      // 起動済みの回は実行しないように、今の回から待ち始める
+      int current_round;
+      {
+        lock_guard<mutex> lock(mtx);
+        current_round = round;
+      }
+
+      for(int thread_id = workers.size()+1; thread_id < thread_count; thread_id++){
+        workers.push_back(thread(&THREAD_POOL::work, this, thread_id, current_round));
+      }
+    }
+
+    /**
+     * 起動したスレッドを全て終了させる(呼び出し元のスレッドを含めたスレッド数は1になる)
+     */
+    void stop_all(){
+      {
+        lock_guard<mutex> lock(mtx);
+        stop = true;
+      }
+      start_cv.notify_all();
+
+      for(int i = 0; i < workers.size(); i++){
+        workers[i].join();
+      }
+
+      workers.clear();
+      stop = false;
+    }
+
+    /**
+     * 呼び出し元のスレッドを含めたスレッド数
+     */
+    int size(){
+      return workers.size() + 1;
+    }
+
+    /**
+     * 全てのスレッドでtaskを実行する
+     * @param task スレッド番号を受け取る関数
+     */
+    void run(const function<void(int)> &task){
+      {
+        lock_guard<mutex> lock(mtx);
+        this->task = task;
+        this->finished = 0;
+        this->round += 1;
+      }
+      start_cv.notify_all();
+
+      task(0);
+
+      unique_lock<mutex> lock(mtx);
+      done_cv.wait(lock, [this]{ return finished == (int)workers.size(); });
+    }
+
+  private:
+    vector<thread> workers;
+    mutex mtx;
+    condition_variable start_cv;
+    condition_variable done_cv;
+    function<void(int)> task;
+    int round;
+    int finished;
+    bool stop;
+
+    void work(int thread_id, int last_round){
+
+      while(true){
+        unique_lock<mutex> lock(mtx);
+        start_cv.wait(lock, [&]{ return stop || round != last_round; });
+        if(stop) return;
+        last_round = round;
+        lock.unlock();
+
+        task(thread_id);
+
+        lock.lock();
+        finished += 1;
+        if(finished == (int)workers.size()){
+          done_cv.notify_one();
+        }
+      }
+    }
+};
+
+// 盤面全体を走査する処理の実装の種類(実行時にCPUに合わせて選ぶ)
+enum BOARD_KERNEL {
+  BOARD_KERNEL_SCALAR,
+  BOARD_KERNEL_SSE41,
+  BOARD_KERNEL_AVX2,
+  BOARD_KERNEL_COUNT
+};
+const char *BOARD_KERNEL_NAME[BOARD_KERNEL_COUNT] = {"scalar", "sse4.1", "avx2"};
+
+/**
+ * 実行しているCPUで使えるかどうかを判定する
+ * @param kernel 実装の種類
+ */
+bool is_board_kernel_supported(int kernel){
+#if defined(__x86_64__) || defined(__i386__)
+  if(kernel == BOARD_KERNEL_AVX2) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+  if(kernel == BOARD_KERNEL_SSE41) return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt");
+#endif
+  return (kernel == BOARD_KERNEL_SCALAR);
+}
+
+/**
+ * 使える中で一番速い実装を選ぶ
+ */
+int detect_board_kernel(){
+  for(int kernel = BOARD_KERNEL_COUNT-1; kernel > BOARD_KERNEL_SCALAR; kernel--){
+    if(is_board_kernel_supported(kernel)) return kernel;
+  }
+  return BOARD_KERNEL_SCALAR;
+}
+
+// 盤面の1セル1バイトの配列(ボールは0-9、WALLとEMPTYは10以上、番兵の枠も含めて1次元に並べる)
+typedef char BOARD_BYTES[MAX_CELL];
+// 色ごとの評価値の平面
+typedef int EVAL_PLANES[10][MAX_CELL];
+// zoblish hashの表
+typedef ll ZOBLISH_TABLE[MAX_CELL][MAX_STATUS];
+
+/**
+ * 目標地点にボールが乗っているセルを数える
+ *   枠は壁なので、先頭からcell_count個のセルをまとめて調べれば良い
+ * @param cell_count 調べるセルの数
+ * @param match_count 同じ色のボールが乗っている数
+ * @param ball_count 色に関係なくボールが乗っている数
+ */
+void count_target_cells_scalar(const BOARD_BYTES &maze, const BOARD_BYTES &target, int cell_count, int &match_count, int &ball_count){
+  match_count = 0;
+  ball_count = 0;
+
+  for(int z = 0; z < cell_count; z++){
+    int color = maze[z];
+    int target_color = target[z];
+
+    if(color < WALL && target_color < WALL){
+      ball_count += 1;
+      if(color == target_color) match_count += 1;
+    }
+  }
+}
+
+/**
+ * ボールがあるセルの評価値の合計
+ * @param color_count 色の数(0からcolor_count-1までの色を調べる)
+ */
+int sum_eval_planes_scalar(const BOARD_BYTES &maze, const EVAL_PLANES &eval_field, int cell_count, int /* color_count */){
+  int eval = 0;
+
+  for(int z = 0; z < cell_count; z++){
+    int color = maze[z];
+    if(color < WALL) eval += eval_field[color][z];
+  }
+
+  return eval;
+}
+
+/**
+ * ボールがあるセルのzoblish hashをまとめる
+ */
+ll xor_zoblish_scalar(const BOARD_BYTES &maze, const ZOBLISH_TABLE &table, int cell_count){
+  ll hash = 0;
+
+  for(int z = 0; z < cell_count; z++){
+    int color = maze[z];
+    if(color < WALL) hash ^= table[z][color];
+  }
+
+  return hash;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * 16セルずつ比較してビットマスクで数える
+ *   最後は配列の内側に収まるように読み込み位置を戻して、調べ済みのセルをマスクで落とす
+ */
+__attribute__((target("sse4.1,popcnt")))
+void count_target_cells_sse41(const BOARD_BYTES &maze, const BOARD_BYTES &target, int cell_count, int &match_count, int &ball_count){
+  if(cell_count < 16){
+    count_target_cells_scalar(maze, target, cell_count, match_count, ball_count);
+    return;
+  }
+
+  const __m128i limit = _mm_set1_epi8(WALL);
+  match_count = 0;
+  ball_count = 0;
+
+  for(int z = 0; z < cell_count; z += 16){
+    int from = min(z, cell_count - 16);
+    __m128i m = _mm_loadu_si128((const __m128i *)&maze[from]);
+    __m128i t = _mm_loadu_si128((const __m128i *)&target[from]);
+    __m128i both = _mm_and_si128(_mm_cmplt_epi8(m, limit), _mm_cmplt_epi8(t, limit));
+    __m128i match = _mm_and_si128(both, _mm_cmpeq_epi8(m, t));
+    int shift = z - from;
+
+    ball_count += __builtin_popcount((unsigned)_mm_movemask_epi8(both) >> shift);
+    match_count += __builtin_popcount((unsigned)_mm_movemask_epi8(match) >> shift);
+  }
+}
+
+/**
+ * 32セルずつ比較してビットマスクで数える
+ */
+__attribute__((target("avx2,popcnt")))
+void count_target_cells_avx2(const BOARD_BYTES &maze, const BOARD_BYTES &target, int cell_count, int &match_count, int &ball_count){
+  if(cell_count < 32){
+    count_target_cells_sse41(maze, target, cell_count, match_count, ball_count);
+    return;
+  }
+
+  const __m256i limit = _mm256_set1_epi8(WALL);
+  match_count = 0;
+  ball_count = 0;
+
+  for(int z = 0; z < cell_count; z += 32){
+    int from = min(z, cell_count - 32);
+    __m256i m = _mm256_loadu_si256((const __m256i *)&maze[from]);
+    __m256i t = _mm256_loadu_si256((const __m256i *)&target[from]);
+    __m256i both = _mm256_and_si256(_mm256_cmpgt_epi8(limit, m), _mm256_cmpgt_epi8(limit, t));
+    __m256i match = _mm256_and_si256(both, _mm256_cmpeq_epi8(m, t));
+    int shift = z - from;
+
+    ball_count += __builtin_popcount((unsigned)_mm256_movemask_epi8(both) >> shift);
+    match_count += __builtin_popcount((unsigned)_mm256_movemask_epi8(match) >> shift);
+  }
+}
+
+/**
+ * 8セルずつ色ごとの平面から評価値を足す(ボールの色と一致する平面だけをマスクで残す)
+ *   色の数だけ盤面を読むので、小さい盤面ではスカラーの方が速い
+ */
+__attribute__((target("avx2")))
+int sum_eval_planes_avx2(const BOARD_BYTES &maze, const EVAL_PLANES &eval_field, int cell_count, int color_count){
+  if(cell_count < 1024) return sum_eval_planes_scalar(maze, eval_field, cell_count, color_count);
+
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i sum = _mm256_setzero_si256();
+
+  for(int z = 0; z < cell_count; z += 8){
+    int from = min(z, cell_count - 8);
+    __m256i colors = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)&maze[from]));
+    // 調べ済みのセルは色を-1にして一致させない
+    __m256i done = _mm256_cmpgt_epi32(_mm256_set1_epi32(z - from), lane);
+    colors = _mm256_or_si256(colors, done);
+
+    for(int color = 0; color < color_count; color++){
+      __m256i mask = _mm256_cmpeq_epi32(colors, _mm256_set1_epi32(color));
+      __m256i value = _mm256_loadu_si256((const __m256i *)&eval_field[color][from]);
+      sum = _mm256_add_epi32(sum, _mm256_and_si256(mask, value));
+    }
+  }
+
+  __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+  half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(half);
+}
+
+/**
+ * 4セルずつ表からgatherしてxorする(ボールが無いセルはマスクで読まない)
+ */
+__attribute__((target("avx2")))
+ll xor_zoblish_avx2(const BOARD_BYTES &maze, const ZOBLISH_TABLE &table, int cell_count){
+  const long long *base = (const long long *)&table[0][0];
+  const __m128i offset = _mm_setr_epi32(0, MAX_STATUS, 2 * MAX_STATUS, 3 * MAX_STATUS);
+  const __m128i limit = _mm_set1_epi32(WALL);
+  __m256i hash = _mm256_setzero_si256();
+  ll rest = 0;
+  int z = 0;
+
+  for(; z + 4 <= cell_count; z += 4){
+    int cells;
+    memcpy(&cells, &maze[z], sizeof(cells));
+    __m128i colors = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(cells));
+    __m128i index = _mm_add_epi32(_mm_add_epi32(_mm_set1_epi32(z * MAX_STATUS), offset), colors);
+    __m256i mask = _mm256_cvtepi32_epi64(_mm_cmplt_epi32(colors, limit));
+
+    hash = _mm256_xor_si256(hash, _mm256_mask_i32gather_epi64(_mm256_setzero_si256(), base, index, mask, 8));
+  }
+
+  for(; z < cell_count; z++){
+    int color = maze[z];
+    if(color < WALL) rest ^= table[z][color];
+  }
+
+  ll lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, hash);
+  return rest ^ lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3];
 }
+#endif
 
-ll g_time_limit = 9500;
+/**
+ * 指定した実装で目標地点にボールが乗っているセルを数える
+ */
+void count_target_cells(int kernel, const BOARD_BYTES &maze, const BOARD_BYTES &target, int cell_count, int &match_count, int &ball_count){
+#if defined(__x86_64__) || defined(__i386__)
+  if(kernel == BOARD_KERNEL_AVX2) return count_target_cells_avx2(maze, target, cell_count, match_count, ball_count);
+  if(kernel == BOARD_KERNEL_SSE41) return count_target_cells_sse41(maze, target, cell_count, match_count, ball_count);
+#endif
+  count_target_cells_scalar(maze, target, cell_count, match_count, ball_count);
+}
+
+/**
+ * 指定した実装でボールがあるセルの評価値の合計を求める
+ */
+int sum_eval_planes(int kernel, const BOARD_BYTES &maze, const EVAL_PLANES &eval_field, int cell_count, int color_count){
+#if defined(__x86_64__) || defined(__i386__)
+  // 4レーンではマスクの処理が読み込みの削減を上回らないのでSSE4.1はスカラーを使う
+  if(kernel == BOARD_KERNEL_AVX2) return sum_eval_planes_avx2(maze, eval_field, cell_count, color_count);
+#endif
+  return sum_eval_planes_scalar(maze, eval_field, cell_count, color_count);
+}
 
-// 実行時間を取得する
+/**
+ * 指定した実装でボールがあるセルのzoblish hashをまとめる
+ */
+ll xor_zoblish(int kernel, const BOARD_BYTES &maze, const ZOBLISH_TABLE &table, int cell_count){
+#if defined(__x86_64__) || defined(__i386__)
+  // gatherが無いSSE4.1では分岐をなくしても速くならないのでスカラーを使う
+  if(kernel == BOARD_KERNEL_AVX2) return xor_zoblish_avx2(maze, table, cell_count);
+#endif
+  return xor_zoblish_scalar(maze, table, cell_count);
+}
+
+// 実行時間を取得する(ms、時刻合わせの影響を受けない単調増加の時計)
 ll get_time() {
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  ll result =  tv.tv_sec * 1000LL + tv.tv_usec / 1000LL;
-  return result;
+  return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+// 回答の判定結果
+struct VERDICT {
+  bool valid;         // 回答が正しい形式かどうか
+  int move_count;     // ボールを転がした回数
+  double score;       // 公式のスコア(不正な回答の場合は0)
+  string message;     // 不正な回答の場合はその理由
+
+  VERDICT(){
+    this->valid = true;
+    this->move_count = 0;
+    this->score = 0.0;
+  }
+};
+
+/**
+ * 回答を初期盤面から再生してスコアを計算する
+ * ルールはREADMEの通りで、不正な転がし方や 20 * (ボールの数) 回を超える転がしがあれば0点になる
+ * @param start 初期盤面
+ * @param target 目標盤面
+ * @param query_list "R C D"形式のボールの操作の一覧
+ * @return 判定結果
+ */
+VERDICT simulate(const vector<string> &start, const vector<string> &target, const vector<string> &query_list){
+  VERDICT verdict;
+  vector<string> maze = start;
+  int height = maze.size();
+  int width = (height > 0)? maze[0].size() : 0;
+  int ball_count = 0;
+
+  for(int y = 0; y < height; y++){
+    for(int x = 0; x < width; x++){
+      if(isdigit(maze[y][x])) ball_count += 1;
+    }
+  }
+
+  verdict.move_count = query_list.size();
+
+  if(query_list.size() > 20 * ball_count){
+    verdict.valid = false;
+    verdict.message = "too many rolls: " + int2string(query_list.size()) + " > " + int2string(20 * ball_count);
+    return verdict;
+  }
+
+  for(int i = 0; i < query_list.size(); i++){
+    int y, x, direct;
+    char rest;
+
+    if(sscanf(query_list[i].c_str(), "%d %d %d %c", &y, &x, &direct, &rest) != 3){
+      verdict.valid = false;
+      verdict.message = "roll " + int2string(i) + ": can't parse \"" + query_list[i] + "\"";
+      return verdict;
+    }
+    if(y < 0 || height <= y || x < 0 || width <= x || direct < 0 || 3 < direct){
+      verdict.valid = false;
+      verdict.message = "roll " + int2string(i) + ": out of range \"" + query_list[i] + "\"";
+      return verdict;
+    }
+    if(!isdigit(maze[y][x])){
+      verdict.valid = false;
+      verdict.message = "roll " + int2string(i) + ": no ball at (" + int2string(y) + ", " + int2string(x) + ")";
+      return verdict;
+    }
+
+    int ny = y;
+    int nx = x;
+
+    while(true){
+      int ty = ny + DY[direct];
+      int tx = nx + DX[direct];
+
+      if(ty < 0 || height <= ty || tx < 0 || width <= tx || maze[ty][tx] != '.') break;
+      ny = ty;
+      nx = tx;
+    }
+
+    swap(maze[y][x], maze[ny][nx]);
+  }
+
+  double score = 0.0;
+
+  for(int y = 0; y < height; y++){
+    for(int x = 0; x < width; x++){
+      if(isdigit(target[y][x]) && isdigit(maze[y][x])){
+        score += (target[y][x] == maze[y][x])? 1.0 : 0.5;
+      }
+    }
+  }
+
+  verdict.score = (ball_count > 0)? score / ball_count : 0.0;
+
+  return verdict;
+}
+
+// ソルバー
+// 1つの問題を解くための状態を全てこのクラスが持つので、
+// インスタンスを分ければ複数の問題を同時に(スレッドごとに)解くことができる
 class RollingBalls {
   public:
+    // メインのスコア(同じ色のボールが目標地点にある)
+    int g_main_score = 1000;
+    // サブのスコア(違う色のボールが目標地点にある)
+    int g_sub_score = -500;
+    // サブのスコアの符号を反転させる手数(ボール1個あたり)
+    int g_sub_score_switch = 10;
+
+    // ビーム幅
+    int g_beam_range;
+    // 探索の深さ
+    int g_beam_depth;
+    // 調べるボールの数
+    int g_search_ball_count;
+    // ビームサーチの展開に使うスレッド数
+    int g_thread_count = 1;
+    // 設定と乱数のシード値を変えて同時に解くソルバーの数(1の場合はポートフォリオを使わない)
+    int g_portfolio_count = 1;
+    // set_beam_config()で決めたビーム幅に掛ける割合(%)
+    int g_beam_range_percent = 100;
+    // 制限時間(ms)
+    ll g_time_limit = 9500;
+    // 盤面全体を走査する処理の実装
+    int g_board_kernel = detect_board_kernel();
+    // 残り時間に合わせてビーム幅と探索対象のボールの数を調整するかどうか
+    bool g_adaptive_beam = true;
+    // 時間が余る場合に広げるビームサーチの深さとビーム幅の上限
+    int g_max_beam_depth = 4;
+    int g_max_beam_range = 1000;
+    // ビーム幅などを調整する間隔(手数と時間(ms)の両方を満たした時に調整する)
+    int g_control_interval = 8;
+    ll g_control_time_interval = 20;
+    // 前回調整した時の手数と時刻と生成ノード数
+    int g_control_move;
+    ll g_control_time;
+    ll g_control_node_count;
+    // 乱数のシード値
+    unsigned long long g_random_seed = 0;
+    // 標準エラー出力に結果を表示するかどうか(統計情報を出力する場合は表示しない)
+    bool g_verbose = true;
+    // ビームサーチで生成したノードの総数
+    ll g_generated_node_count = 0;
+    // 探索の統計情報をJSON Linesで出力するかどうか
+    bool g_stats_enabled = false;
+    // 統計情報の出力先
+    FILE *g_stats_output = stderr;
+    // 統計情報に付ける名前(バッチで問題を区別するため)
+    string g_stats_label = "";
+    // 現在の手の統計情報
+    SEARCH_STATS g_stats;
+    // 統計情報と一緒にハードウェアカウンタの値も計測するかどうか
+    bool g_perf_enabled = false;
+    // ハードウェアカウンタが使えるかどうか
+    bool g_perf_available = false;
+    // 今解いている問題で統計情報を出力するかどうか(設定のg_stats_enabledは書き換えない)
+    bool g_stats_active = false;
+    // ハードウェアカウンタ(restorePatternを呼んだスレッドの分だけ数える)
+    PERF_COUNTER g_perf_counter;
+    // 最後に解いた問題の統計情報の合計
+    SEARCH_STATS g_total_stats;
+    // 最後に解いた問題の初期化にかかった時間(ms、統計情報を出力しない場合も計測する)
+    double g_init_time = 0.0;
+
+    // 高さ
+    int g_height;
+    // 横幅
+    int g_width;
+    // 番兵の枠を含めた1行のセル数(1次元の座標でy方向に1つ進む時の差)
+    int g_stride;
+    // 番兵の枠を含めたセルの数
+    int g_cell_count;
+    // 1次元の座標で各方向に1つ進む時の差
+    int g_dz[4];
+    // ボールの総数
+    int g_total_ball_count;
+    // ボールの種類の数
+    int g_ball_type_count;
+    // ボールの色の最大値+1
+    int g_color_count;
+    // 評価値をつける転がし回数の上限
+    int g_roll_distance_limit = 4;
+    int g_total_target_count;
+
+    // 迷路
+    char g_maze[MAX_CELL];
+    // 目標の盤面
+    char g_target[MAX_CELL];
+    // 評価用の盤面(色ごとに1枚の平面になるように色を先頭の添字にしている)
+    int g_eval_field[10][MAX_CELL];
+    // 壁だけを考えた時に各セルから各色の目的地まで転がす最小回数(届かない場合はUNREACHABLE)
+    unsigned char g_roll_distance[MAX_CELL][10];
+    // ボールのリスト
+    vector<BALL> g_ball_list;
+    // 目標のリスト
+    vector<TARGET> g_target_list;
+    // 色ごとのボールと目標地点の割当
+    ASSIGNMENT g_assignment_list[10];
+    // ボールが割当の何行目に対応しているか
+    vector<int> g_assignment_row;
+    // 割り当てた目標地点に近づいた時に評価値に加える重み(1マスあたり)
+    int g_assignment_weight = 2;
+    // 割当の費用で、目標地点まで転がす回数1回をマンハッタン距離何マス分とみなすか
+    int g_assignment_roll_weight = 3;
+    // 壁だけを考えた時に各セルから各目標地点まで転がす最小回数(target_id * g_cell_count + zの位置)
+    vector<unsigned char> g_target_distance;
+    // ボールの状態ごとの組(roll()で更新する)
+    BALL_INDEX g_ball_index;
+    // 探索対象のボールを選ぶ時の組ごとの重み(1個あたり)
+    int g_ball_class_weight[BALL_CLASS_COUNT] = {1, 4, 6, 4, 2};
+    // 各セルにあるボールのID(ボールが無いセルはUNKNOWN、roll()で更新する)
+    int g_ball_cell[MAX_CELL];
+    // 各セルが属する壁で区切られた区間の番号(0: 横の区間, 1: 縦の区間)
+    int g_segment_id[MAX_CELL][2];
+    // 区間ごとの空いている(同じ色のボールが乗っていない)目標地点の数
+    vector<int> g_open_target_count;
+    // zoblish hash作成用盤面
+    ll g_zoblish_field[MAX_CELL][MAX_STATUS];
+    // ビームサーチで調べた盤面のハッシュ値
+    HASH_SET g_check_list;
+    // 全スレッドの子ノードの候補をまとめたもの(領域を使い回す)
+    vector<CANDIDATE> g_candidate_list;
+    // ボールの位置(g_mazeと常に同じ状態を保つ)
+    BITBOARD g_ball_bits;
+    // 現在の盤面のスコア、評価値、公式のスコア、ハッシュ値(roll()で差分更新する)
+    int g_board_score;
+    int g_board_eval;
+    int g_board_point;
+    ll g_board_hash;
+    // 各セルから各方向に転がした時に壁(もしくは端)で止まる座標
+    // 方向0,2の場合はx座標、方向1,3の場合はy座標が入る
+    unsigned char g_wall_stop[MAX_HEIGHT][MAX_WIDTH][4];
+    // スレッドごとの作業領域
+    vector<WORKER> g_worker_list;
+    // ビームサーチの展開に使うスレッド
+    THREAD_POOL g_thread_pool;
+
+    // 乱数の状態
+    unsigned long long rx, ry, rz, rw;
+
+    /**
+     * 乱数の状態を初期化する
+     * @param seed シード値(0の場合は従来の初期値)
+     */
+    void init_random(unsigned long long seed){
+      rx = 123456789;
+      ry = 362436069;
+      rz = 521288629;
+      rw = 88675123 ^ seed;
+    }
+
+    // 乱数生成
+    unsigned long long xor128(){
+      unsigned long long rt = (rx ^ (rx<<11));
+      rx=ry; ry=rz; rz=rw;
+      return (rw=(rw^(rw>>19))^(rt^(rt>>8)));
+    }
+
     /**
      * 初期化関数
      * @param start 初期盤面
      * @param target 目標盤面
      */
-    void init(vector<string> start, vector<string> target){
+    void init(const vector<string> &start, const vector<string> &target){
       g_height = start.size();
       g_width = start[0].size();
+      g_stride = g_width + 2;
+      g_cell_count = (g_height + 2) * g_stride;
+      for(int direct = 0; direct < 4; direct++){
+        g_dz[direct] = DY[direct] * g_stride + DX[direct];
+      }
+
+      // 前回の問題の状態を消す
+      g_ball_list.clear();
+      g_target_list.clear();
+      init_random(g_random_seed);
+
+      // 展開用のスレッドを起動する(割当の初期化でも使う)
+      //   スレッド数が変わった場合は、作業領域を作り直す前にスレッドを全て止める
+      g_thread_count = max(1, g_thread_count);
+      if(g_thread_pool.size() != g_thread_count){
+        g_thread_pool.stop_all();
+        // ハードウェアカウンタは開いたスレッドの分を数えるので、スレッドと一緒に作り直す
+        g_worker_list.clear();
+        g_thread_pool.start(g_thread_count);
+      }
+      g_worker_list.resize(g_thread_count);
 
       init_zoblish_field();
       init_maze(start);
+      init_wall_stop();
       init_target(target);
 
       // ビームサーチの設定値を決める
       set_beam_config();
 
+      // 1回のビームサーチで生成されるノード数の上限だけ確保しておく
+      g_check_list.init(g_beam_range * g_search_ball_count * 4 * g_beam_depth + 1);
+
+      // 展開用の作業領域を準備する
+      for(int thread_id = 0; thread_id < g_thread_count; thread_id++){
+        g_worker_list[thread_id].check_list.init(g_beam_range * g_search_ball_count * 4);
+      }
+
       // 評価値盤面の更新
       update_eval_field();
+      init_ball_index();
+
+      // 以降はroll()で差分更新する
+      g_board_score = get_score();
+      g_board_eval = get_eval();
+      g_board_point = get_point_total();
+      g_board_hash = get_zoblish_hash();
     }
 
     /**
      * mazeの初期化
      * @param start 初期盤面
      */
-    void init_maze(vector<string> start){
+    void init_maze(const vector<string> &start){
       g_total_ball_count = 0;
       g_ball_type_count = 0;
+      g_color_count = 0;
 
-      map<int, bool> check_list;
+      bool check_list[10] = {};
+      g_ball_bits.clear();
+      // 盤面の外側は壁で囲っておく
+      memset(g_maze, WALL, sizeof(g_maze));
 
       for(int y = 0; y < g_height; y++){
         for(int x = 0; x < g_width; x++){
           char ch = start[y][x];
 
           if(ch == '#'){
-            g_maze[y][x] = WALL;
+            g_maze[getZ(y, x)] = WALL;
           }else if(ch == '.'){
-            g_maze[y][x] = EMPTY;
+            g_maze[getZ(y, x)] = EMPTY;
           }else{
             int color = char2int(ch);
-            g_maze[y][x] = color;
+            g_maze[getZ(y, x)] = color;
             g_total_ball_count += 1;
 
             if(!check_list[color]){
               check_list[color] = true;
               g_ball_type_count += 1;
             }
+            g_color_count = max(g_color_count, color + 1);
 
             g_ball_list.push_back(BALL(y, x, color));
+            g_ball_bits.set(y, x);
           }
         }
       }
     }
 
+    /**
+     * 壁で止まる位置の表を作成する
+     */
+    void init_wall_stop(){
+      for(int y = 0; y < g_height; y++){
+        for(int x = 0; x < g_width; x++){
+          g_wall_stop[y][x][0] = (is_wall(y, x-1))? x : g_wall_stop[y][x-1][0];
+          g_wall_stop[y][x][3] = (is_wall(y-1, x))? y : g_wall_stop[y-1][x][3];
+        }
+      }
+      for(int y = g_height-1; y >= 0; y--){
+        for(int x = g_width-1; x >= 0; x--){
+          g_wall_stop[y][x][2] = (is_wall(y, x+1))? x : g_wall_stop[y][x+1][2];
+          g_wall_stop[y][x][1] = (is_wall(y+1, x))? y : g_wall_stop[y+1][x][1];
+        }
+      }
+    }
+
     /**
      * targetフィールドの初期化
      */
-    void init_target(vector<string> target){
+    void init_target(const vector<string> &target){
       g_total_target_count = 0;
+      memset(g_target, WALL, sizeof(g_target));
 
       for(int y = 0; y < g_height; y++){
         for(int x = 0; x < g_width; x++){
           char ch = target[y][x];
 
           if(ch == '#'){
-            g_target[y][x] = WALL;
+            g_target[getZ(y, x)] = WALL;
           }else if(ch == '.'){
-            g_target[y][x] = EMPTY;
+            g_target[getZ(y, x)] = EMPTY;
           }else{
             int color = char2int(ch);
-            g_target[y][x] = color;
+            g_target[getZ(y, x)] = color;
 
-            int target_id = getZ(y,x);
-            mapping_ball(target_id, color);
             g_total_target_count += 1;
             g_target_list.push_back(TARGET(y, x, color));
           }
         }
       }
+
+      init_assignment();
     }
     
     /**
-     * ボールと特定の目標地点を結びつける
-     * @param target_id 目標地点のID
+     * 色ごとにボールと目標地点の割当を作成する
+     *   費用は目標地点までの距離で、総和が最小になるように割り当てる
+     */
+    void init_assignment(){
+      g_assignment_row.assign(g_total_ball_count, UNKNOWN);
+      g_target_distance.resize(g_target_list.size() * g_cell_count);
+
+      // 色ごとに独立しているので、スレッドごとに別の色を受け持つ
+      if(g_thread_count == 1){
+        for(int color = 0; color < 10; color++){
+          init_color_assignment(color, 0);
+        }
+      }else{
+        run_workers(PHASE_INIT, [&](int thread_id){
+          for(int color = thread_id; color < 10; color += g_thread_count){
+            init_color_assignment(color, thread_id);
+          }
+        });
+      }
+    }
+
+    /**
+     * 1色分のボールと目標地点の割当を作成する
+     *   書き込むのはこの色のボールと目標地点の分だけなので、別の色と同時に呼び出せる
      * @param color 色
+     * @param thread_id 呼び出したスレッドの番号(作業領域に使う)
      */
-    void mapping_ball(int target_id, int color){
+    void init_color_assignment(int color, int thread_id){
+      ASSIGNMENT *assignment = &g_assignment_list[color];
+      int ball_count = 0;
+      int target_count = 0;
+
+      // 一時的な配列を作らないように、先に数えてから割当の行と列に直接入れる
       for(int ball_id = 0; ball_id < g_total_ball_count; ball_id++){
-        BALL *ball = get_ball(ball_id);
+        ball_count += (get_ball(ball_id)->color == color);
+      }
+      for(int target_id = 0; target_id < g_target_list.size(); target_id++){
+        target_count += (get_target(target_id)->color == color);
+      }
+
+      assignment->init(max(ball_count, target_count));
+
+      int row = 0;
+      for(int ball_id = 0; ball_id < g_total_ball_count; ball_id++){
+        if(get_ball(ball_id)->color != color) continue;
+
+        row += 1;
+        assignment->ball_ids[row] = ball_id;
+        g_assignment_row[ball_id] = row;
+      }
+
+      int col = 0;
+      for(int target_id = 0; target_id < g_target_list.size(); target_id++){
+        if(get_target(target_id)->color != color) continue;
+
+        col += 1;
+        assignment->target_ids[col] = target_id;
+        init_target_distance(target_id, g_worker_list[thread_id].cell_queue);
+      }
+      for(int row = 1; row <= assignment->size; row++){
+        update_assignment_cost(assignment, row);
+      }
+
+      assignment->solve();
+      apply_assignment(assignment);
+    }
+
+    /**
+     * 移動したボールの割当を修正する
+     * @param ball_id ボールのID
+     * @return (true: 割当が変わった, false: 変わっていない)
+     */
+    bool update_assignment(int ball_id){
+      BALL *ball = get_ball(ball_id);
+      ASSIGNMENT *assignment = &g_assignment_list[ball->color];
+      int row = g_assignment_row[ball_id];
 
-        if(ball->target_id != UNKNOWN) continue;
-        
-        if(ball->color == color){
-          ball->target_id = target_id;
+      update_assignment_cost(assignment, row);
+      assignment->update_row(row);
+
+      return apply_assignment(assignment);
+    }
+
+    /**
+     * 割当の1行分の費用を計算する
+     * @param assignment 割当
+     * @param row 行
+     */
+    void update_assignment_cost(ASSIGNMENT *assignment, int row){
+      int ball_id = assignment->ball_ids[row];
+
+      for(int col = 1; col <= assignment->size; col++){
+        int target_id = assignment->target_ids[col];
+
+        if(ball_id == UNKNOWN || target_id == UNKNOWN){
+          assignment->cost[row][col] = 0;
+        }else{
+          BALL *ball = get_ball(ball_id);
+          assignment->cost[row][col] = get_target_dist(target_id, ball->y, ball->x);
+        }
+      }
+    }
+
+    /**
+     * 割当の結果をボールに反映する
+     * @param assignment 割当
+     * @return (true: 割当が変わった, false: 変わっていない)
+     */
+    bool apply_assignment(ASSIGNMENT *assignment){
+      bool changed = false;
+
+      for(int col = 1; col <= assignment->size; col++){
+        int ball_id = assignment->ball_ids[assignment->owner[col]];
+        if(ball_id == UNKNOWN) continue;
+
+        BALL *ball = get_ball(ball_id);
+        if(ball->target_id != assignment->target_ids[col]){
+          ball->target_id = assignment->target_ids[col];
+          changed = true;
         }
       }
+
+      return changed;
     }
 
     /**
@@ -297,131 +1680,339 @@ class RollingBalls {
      * @return ボールの操作クエリの一覧
      */
     vector<string> restorePattern(vector<string> start, vector<string> target){
-      vector<string> query_list;
+      if(g_portfolio_count > 1) return restore_pattern_portfolio(start, target);
 
-      init(start, target);
+      vector<string> query_list;
 
-      map<ll, bool> check_list;
+      // ハードウェアカウンタは統計情報と一緒に出力する
+      g_stats_active = g_stats_enabled || g_perf_enabled;
+      g_perf_available = g_perf_enabled && g_perf_counter.open_all();
+      g_total_stats.clear();
+      g_stats.clear();
 
+      // 初期化の時間も制限時間に含める
       ll start_time = get_time();
       ll end_time = start_time + g_time_limit;
+
+      PHASE_MARK init_start = start_phase();
+      chrono::steady_clock::time_point init_begin = chrono::steady_clock::now();
+      init(start, target);
+      g_init_time = chrono::duration<double, milli>(chrono::steady_clock::now() - init_begin).count();
+      end_phase(PHASE_INIT, init_start);
+      g_total_stats.add(g_stats);
+
+      // 途中で符号を反転させるので、次の問題のために元の値を覚えておく
+      int sub_score = g_sub_score;
+
       ll current_time = get_time();
+      g_control_move = 0;
+      g_control_time = current_time;
+      g_control_node_count = g_generated_node_count;
 
-      for(int i = 0; i < g_total_ball_count * 20; i++){
-        QUERY query = beam_search(xor128()%g_total_ball_count);
+      int move_limit = g_total_ball_count * 20;
+      int move_count = 0;
+      bool timeout = false;
 
-        if(i == g_total_ball_count * 10){
+      // 途中の盤面の方が公式のスコアが高い場合はそこまでの手順を返す
+      int best_point = g_board_point;
+      int best_move_count = 0;
+
+      for(int i = 0; i < move_limit; i++){
+        g_stats.clear();
+        QUERY query = beam_search();
+
+        if(i == g_total_ball_count * g_sub_score_switch){
           g_sub_score *= -1;
+          g_board_score = get_score();
         }
 
         if(query.ball_id != UNKNOWN){
+          PHASE_MARK roll_start = start_phase();
           roll(query.ball_id, query.y, query.x, query.direct);
+          end_phase(PHASE_ROLL, roll_start);
           query_list.push_back(query2string(query));
+
+          if(best_point < g_board_point){
+            best_point = g_board_point;
+            best_move_count = query_list.size();
+          }
+        }
+
+        move_count = i + 1;
+
+        if(g_stats_active){
+          g_total_stats.add(g_stats);
+          // バッチでは複数のスレッドが同じ出力先に書くので、1行を書き終えるまでロックする
+          flockfile(g_stats_output);
+          fprintf(g_stats_output, "{\"type\": \"move\", \"label\": \"%s\", \"move\": %d, ", escape_json(g_stats_label).c_str(), i);
+          g_stats.write(g_stats_output, false);
+          fprintf(g_stats_output, "}\n");
+          funlockfile(g_stats_output);
         }
 
         current_time = get_time();
 
         if(end_time < current_time){
+          timeout = (move_count < move_limit);
           break;
         }
+
+        if(g_adaptive_beam && move_count - g_control_move >= g_control_interval && current_time - g_control_time >= g_control_time_interval){
+          adjust_beam_config(move_count, move_limit, current_time, end_time);
+        }
+      }
+
+      if(best_move_count < query_list.size()){
+        query_list.resize(best_move_count);
+      }
+
+      if(g_stats_active){
+        flockfile(g_stats_output);
+        fprintf(g_stats_output, "{\"type\": \"summary\", \"label\": \"%s\", \"height\": %d, \"width\": %d, \"balls\": %d, "
+            "\"moves\": %d, \"returned_moves\": %d, \"move_limit\": %d, \"timeout\": %s, \"elapsed_ms\": %lld, ",
+            escape_json(g_stats_label).c_str(), g_height, g_width, g_total_ball_count,
+            move_count, (int)query_list.size(), move_limit, (timeout)? "true" : "false", get_time() - start_time);
+        g_total_stats.write(g_stats_output);
+        // perfの値は全てのスレッドの合計
+        fprintf(g_stats_output, ", \"size_class\": \"%s\", \"threads\": %d, ", get_size_class(g_height * g_width), g_thread_count);
+        g_total_stats.write_perf(g_stats_output, g_perf_available);
+        fprintf(g_stats_output, "}\n");
+        funlockfile(g_stats_output);
+      }
+      if(is_verbose()){
+        fprintf(stderr,"ball type count = %d\n", g_ball_type_count);
+        fprintf(stderr,"ball count = %d, target count = %d\n", g_total_ball_count, g_total_target_count);
+        fprintf(stderr,"current score = %f\n", get_score()/(double)g_total_ball_count/1000.0);
       }
-      fprintf(stderr,"ball type count = %d\n", g_ball_type_count);
-      fprintf(stderr,"ball count = %d, target count = %d\n", g_total_ball_count, g_total_target_count);
-      fprintf(stderr,"current score = %f\n", get_score()/(double)g_total_ball_count/1000.0);
+
+      g_sub_score = sub_score;
 
       return query_list;
     }
-    
+
+    /**
+     * 探索の設定を全て別のソルバーから写す
+     *   スレッド数、ポートフォリオの数、出力や統計情報の設定は写さない
+     * @param other 写し元のソルバー
+     */
+    void copy_settings(const RollingBalls &other){
+      g_main_score = other.g_main_score;
+      g_sub_score = other.g_sub_score;
+      g_sub_score_switch = other.g_sub_score_switch;
+      g_beam_range_percent = other.g_beam_range_percent;
+      g_time_limit = other.g_time_limit;
+      g_board_kernel = other.g_board_kernel;
+      g_adaptive_beam = other.g_adaptive_beam;
+      g_max_beam_depth = other.g_max_beam_depth;
+      g_max_beam_range = other.g_max_beam_range;
+      g_control_interval = other.g_control_interval;
+      g_control_time_interval = other.g_control_time_interval;
+      g_random_seed = other.g_random_seed;
+      g_roll_distance_limit = other.g_roll_distance_limit;
+      g_assignment_weight = other.g_assignment_weight;
+      g_assignment_roll_weight = other.g_assignment_roll_weight;
+      memcpy(g_ball_class_weight, other.g_ball_class_weight, sizeof(g_ball_class_weight));
+    }
+
+    /**
+     * 設定と乱数のシード値を変えた複数のソルバーを1つずつスレッドで同時に動かし、
+     * 回答を再生して一番スコアが高いものを返す
+     * (各ソルバーは展開に1スレッドだけを使い、統計情報は出力しない)
+     * @param start 初期盤面
+     * @param target 目標とする盤面
+     * @return ボールの操作クエリの一覧
+     */
+    vector<string> restore_pattern_portfolio(const vector<string> &start, const vector<string> &target){
+      ll start_time = get_time();
+      int member_count = g_portfolio_count;
+      vector<RollingBalls*> members(member_count);
+      vector< vector<string> > answers(member_count);
+
+      for(int member_id = 0; member_id < member_count; member_id++){
+        const PORTFOLIO_PARAM &param = PORTFOLIO_PARAM_LIST[member_id % PORTFOLIO_PARAM_COUNT];
+        RollingBalls *member = new RollingBalls();
+
+        member->copy_settings(*this);
+        member->g_random_seed = g_random_seed + member_id;
+        member->g_verbose = false;
+        member->g_beam_range_percent = g_beam_range_percent * param.beam_range_percent / 100;
+        // 0番目の設定のソルバーは呼び出し元の設定のまま動かす
+        if(member_id % PORTFOLIO_PARAM_COUNT != 0){
+          member->g_roll_distance_limit = param.roll_distance_limit;
+          member->g_assignment_weight = param.assignment_weight;
+          member->g_main_score = param.main_score;
+          member->g_sub_score = param.sub_score;
+        }
+        members[member_id] = member;
+      }
+
+      // ソルバーの準備にかかった時間も制限時間に含める
+      ll time_limit = max(1LL, g_time_limit - (get_time() - start_time));
+      vector<thread> threads;
+      for(int member_id = 0; member_id < member_count; member_id++){
+        members[member_id]->g_time_limit = time_limit;
+        threads.push_back(thread([&, member_id]{
+          answers[member_id] = members[member_id]->restorePattern(start, target);
+        }));
+      }
+      for(int member_id = 0; member_id < member_count; member_id++){
+        threads[member_id].join();
+      }
+
+      // 不正な回答は選ばない(全て不正な場合は何もしない回答を返す)
+      int best_id = UNKNOWN;
+      double best_score = -1.0;
+      g_generated_node_count = 0;
+
+      for(int member_id = 0; member_id < member_count; member_id++){
+        VERDICT verdict = simulate(start, target, answers[member_id]);
+        g_generated_node_count += members[member_id]->g_generated_node_count;
+
+        if(is_verbose()){
+          fprintf(stderr, "portfolio %d: valid = %d, moves = %d, score = %f\n",
+              member_id, verdict.valid, verdict.move_count, verdict.score);
+        }
+        if(verdict.valid && best_score < verdict.score){
+          best_score = verdict.score;
+          best_id = member_id;
+        }
+      }
+
+      vector<string> query_list;
+      if(best_id != UNKNOWN){
+        RollingBalls *best = members[best_id];
+        query_list = answers[best_id];
+        g_height = best->g_height;
+        g_width = best->g_width;
+        g_total_ball_count = best->g_total_ball_count;
+        g_ball_type_count = best->g_ball_type_count;
+        g_total_target_count = best->g_total_target_count;
+        g_total_stats = best->g_total_stats;
+        g_init_time = best->g_init_time;
+      }
+
+      for(int member_id = 0; member_id < member_count; member_id++){
+        delete members[member_id];
+      }
+
+      if(is_verbose()){
+        fprintf(stderr, "portfolio best = %d, score = %f, elapsed = %lld ms\n", best_id, best_score, get_time() - start_time);
+      }
+
+      return query_list;
+    }
+    
+    /**
+     * 公式のスコア * 2 * (ボールの数) を取得する
+     * (同じ色なら2点、違う色なら1点)
+     */
+    int get_point_total(){
+      int match_count, ball_count;
+      count_target_cells(g_board_kernel, g_maze, g_target, g_cell_count, match_count, ball_count);
+
+      return 2 * match_count + (ball_count - match_count);
+    }
+
+    /**
+     * 公式のスコアの差分更新を行う
+     */
+    inline int update_point(int point, int color, int y1, int x1, int y2, int x2){
+      int t1 = g_target[getZ(y1, x1)];
+      int t2 = g_target[getZ(y2, x2)];
+
+      if(is_ball(t1)) point -= (color == t1)? 2 : 1;
+      if(is_ball(t2)) point += (color == t2)? 2 : 1;
+
+      return point;
+    }
+
     /**
      * ビーーーーームサーチ
      * 現在の盤面から一番ベストなボールの操作を取得する
      * @return query ボールの操作クエリ
      */
-    QUERY beam_search(int start_id){
+    QUERY beam_search(){
       // 同じ盤面を調べないようにハッシュ値を保存する
-      map<ll, bool> check_list;
+      g_check_list.clear();
       // 一番最初のハッシュを取得(後はこれに対して差分更新)
-      ll root_hash = get_zoblish_hash();
-      // 一番最初の盤面を保存
-      memcpy(g_origin_maze, g_maze, sizeof(g_maze));
+      ll root_hash = g_board_hash;
 
       QUERY best_query;
       int max_eval = INT_MIN;
 
-      // 評価する盤面のキュー
-      queue<NODE> node_queue;
+      // 探索対象のボールのID
+      int search_ball_ids[MAX_SEARCH_BALL_COUNT];
+      select_search_balls(search_ball_ids, g_search_ball_count);
+
+      // 深さごとに生き残ったノードを保存する
+      vector< vector<NODE> > layers(g_beam_depth+1);
 
       // rootなノードを作成
-      NODE root_node = create_node();
-      root_node.score = get_score();
+      NODE root_node;
+      root_node.score = g_board_score;
       root_node.hash = root_hash;
-      root_node.eval = get_eval();
+      root_node.eval = g_board_eval;
+
+      for(int i = 0; i < g_search_ball_count; i++){
+        BALL *ball = get_ball(search_ball_ids[i]);
+        root_node.ball_y[i] = ball->y;
+        root_node.ball_x[i] = ball->x;
+      }
 
       // 初期のキューに追加
-      node_queue.push(root_node);
+      layers[0].push_back(root_node);
 
       // 初期盤面は飛ばすように
-      check_list[root_hash] = true;
-
-      for(int depth = 0; depth < g_beam_depth; depth++){
-        priority_queue< NODE, vector<NODE>, greater<NODE> > pque;
-
-        // 候補の盤面が空になるまで繰り返す
-        while(!node_queue.empty()){
-          // 親の盤面を取得
-          NODE parent = node_queue.front(); node_queue.pop();
-
-          memcpy(g_maze, parent.maze, sizeof(parent.maze));
-
-          for(int i = 0; i < g_search_ball_count; i++){
-            int ball_id = (start_id + i)%g_total_ball_count;
-            BALL *ball = get_ball(ball_id);
-
-
-            // 4方向にコロコロ
-            for(int direct = 0; direct < 4; direct++){
-              COORD coord = roll_ball(ball->y, ball->x, direct);
-
-              // ボールが1マスも進んでいない場合は処理を飛ばす
-              if(coord.y == ball->y && coord.x == ball->x) continue;
-
-              // ボールをコロコロ
-              swap(g_maze[ball->y][ball->x], g_maze[coord.y][coord.x]);
-              // ハッシュ値を再計算
-              ll new_hash = update_zoblish_hash(parent.hash, ball->y, ball->x, ball->color, coord.y, coord.x, ball->color);
-
-              // 既に調べた盤面以外は評価を行わない
-              if(!check_list[new_hash]){
-                check_list[new_hash] = true;
-
-                // 子ノードを作成
-                NODE child = create_node();
-                child.hash = new_hash;
-                child.score = update_score(parent.score, ball->y, ball->x, coord.y, coord.x);
-                child.eval = update_eval(parent.eval, ball->color, ball->y, ball->x, coord.y, coord.x);
+      g_check_list.insert(root_hash);
 
-                // 初期の探索の時はクエリを作成 
-                if(depth == 0){
-                  child.query = QUERY(ball_id, ball->y, ball->x, direct);
+      for(int i = 0; i < g_thread_count; i++){
+        g_worker_list[i].ball_bits = g_ball_bits;
+      }
 
-                // それ以外は親のクエリを引き継ぐ
-                }else{
-                  child.query = parent.query;
-                }
-                // 候補に追加
-                pque.push(child);
-              }
+      for(int depth = 0; depth < g_beam_depth; depth++){
+        const vector<NODE> &parents = layers[depth];
+        g_candidate_list.clear();
 
-              // 再度ボールをコロコロ(2回swapさせることで元の盤面に戻す)
-              swap(g_maze[ball->y][ball->x], g_maze[coord.y][coord.x]);
+        // 親ノードを連続した区間に分けて各スレッドで展開する
+        PHASE_MARK expand_start = start_phase();
+        if(g_thread_count == 1){
+          expand_nodes(0, parents, 0, parents.size(), root_node, search_ball_ids);
+        }else{
+          run_workers(PHASE_EXPAND, [&](int thread_id){
+            int begin = parents.size() * thread_id / g_thread_count;
+            int end = parents.size() * (thread_id+1) / g_thread_count;
+            expand_nodes(thread_id, parents, begin, end, root_node, search_ball_ids);
+          });
+        }
+        end_phase(PHASE_EXPAND, expand_start);
+        PHASE_MARK select_start = start_phase();
+
+        // スレッドの順番に候補をまとめる(スレッド間の重複はここで取り除く)
+        for(int thread_id = 0; thread_id < g_thread_count; thread_id++){
+          vector<CANDIDATE> &candidates = g_worker_list[thread_id].candidates;
+          g_generated_node_count += candidates.size();
+          g_stats.generated_count += candidates.size() + g_worker_list[thread_id].duplicate_count;
+          g_stats.duplicate_count += g_worker_list[thread_id].duplicate_count;
+
+          for(int i = 0; i < candidates.size(); i++){
+            if(g_check_list.insert(candidates[i].hash)){
+              g_candidate_list.push_back(candidates[i]);
+              g_candidate_list.back().order = g_candidate_list.size();
+            }else{
+              g_stats.duplicate_count += 1;
             }
           }
         }
 
-        // ビーム幅の数だけ盤面を残す
-        for(int i = 0; i < g_beam_range && !pque.empty(); i++){
-          NODE node = pque.top(); pque.pop();
-          node_queue.push(node);
+        // ビーム幅の数だけ候補を選んで(評価値の高い順に並べて)ノードにする
+        int keep_count = min(g_beam_range, (int)g_candidate_list.size());
+        nth_element(g_candidate_list.begin(), g_candidate_list.begin() + keep_count, g_candidate_list.end(), greater<CANDIDATE>());
+        sort(g_candidate_list.begin(), g_candidate_list.begin() + keep_count, greater<CANDIDATE>());
+        layers[depth+1].reserve(keep_count);
+
+        for(int i = 0; i < keep_count; i++){
+          layers[depth+1].push_back(create_node(g_candidate_list[i], parents, depth, search_ball_ids));
+          const NODE &node = layers[depth+1].back();
 
           // 探索中に一番評価値が高いやつを残す
           if(max_eval < node.eval + node.score){
@@ -429,142 +2020,254 @@ class RollingBalls {
             best_query = node.query;
           }
         }
+        g_stats.kept_count += layers[depth+1].size();
+        end_phase(PHASE_SELECT, select_start);
       }
 
-      // 元に戻す
-      memcpy(g_maze, g_origin_maze, sizeof(g_origin_maze));
-
       return best_query;
     }
 
     /**
-     * ボールを転がす
-     * @param y y座標
-     * @param x x座標
-     * @param direct 転がす方向
-     * @return coord 転がした後のボールの位置
+     * ビームに残った候補から子ノードを作成する(ボールの位置は親から引き継いで差分だけ更新)
+     * @param candidate 候補
+     * @param parents 親ノードの一覧
+     * @param depth 親ノードの深さ
+     * @param search_ball_ids 探索対象のボールのID
      */
-    COORD roll_ball(int y, int x, int direct){
-      do {
-        y += DY[direct];
-        x += DX[direct];
-      }while(is_inside(y, x) && g_maze[y][x] == EMPTY);
-
-      y -= DY[direct];
-      x -= DX[direct];
+    NODE create_node(const CANDIDATE &candidate, const vector<NODE> &parents, int depth, const int *search_ball_ids){
+      const NODE &parent = parents[candidate.parent];
+      int i = candidate.index;
+
+      NODE child = parent;
+      child.parent = candidate.parent;
+      child.ball_y[i] = candidate.to_y;
+      child.ball_x[i] = candidate.to_x;
+      child.hash = candidate.hash;
+      child.score = candidate.score;
+      child.eval = candidate.eval;
+
+      // 初期の探索の時はクエリを作成
+      if(depth == 0){
+        child.query = QUERY(search_ball_ids[i], parent.ball_y[i], parent.ball_x[i], candidate.direct);
+      }
 
-      return COORD(y, x);
+      return child;
     }
 
     /**
-     * 再帰的に床を滑る
-     * @param y y座標
-     * @param x x座標
-     * @param direct 滑る方向
-     */
-    void slip(int color, int y, int x, int direct, int depth, map<int, bool> &check_list){
-      string pad = "";
-      for(int i = 0; i < depth; i++){
-        pad += "  ";
-      }
-
-      // 限界まで滑る
-      if(depth > g_slip_limit){
-        //fprintf(stderr,"%sslip end(limit)!!!\n", pad.c_str());
-        return;
-      }
-
-      int z = getZ(y,x);
-      if(check_list[z]) return;
-      check_list[z] = true;
-
-      int ny = y + DY[direct];
-      int nx = x + DX[direct];
-
-      /**
-       * 床を滑る
-       */
-      while(is_inside(ny, nx) && g_maze[ny][nx] != WALL){
-        if(direct % 2 == 0){
-          int dy = ny + DY[1];
-          int dx = nx + DX[1];
-          int uy = ny + DY[3];
-          int ux = nx + DX[3];
-
-          if(is_inside(dy, dx) && is_inside(uy, ux)){
-            if((g_maze[uy][ux] == WALL) ^ (g_maze[dy][dx] == WALL)){
-              if(g_maze[uy][ux] == WALL){
-                //fprintf(stderr,"%s(%d, %d, %d, depth = %d) go down\n", pad.c_str(), ny, nx, 1, depth);
-                slip(color, ny, nx, 1, depth+1, check_list);
-              }else{
-                //fprintf(stderr,"%s(%d, %d, %d, depth = %d) go up\n", pad.c_str(), ny, nx, 3, depth);
-                slip(color, ny, nx, 3, depth+1, check_list);
-              }
-            }
-          }else if(is_outside(dy, dx) && g_maze[uy][ux] == EMPTY){
-            //fprintf(stderr,"%s(%d, %d, %d, depth = %d) go down\n", pad.c_str(), ny, nx, 1, depth);
-            slip(color, ny, nx, 1, depth+1, check_list);
-          }else if(is_outside(uy, ux) && g_maze[dy][dx] == EMPTY){
-            //fprintf(stderr,"%s(%d, %d, %d, depth = %d) go up\n", pad.c_str(), ny, nx, 3, depth);
-            slip(color, ny, nx, 3, depth+1, check_list);
-          }
-        }else{
-          int ly = ny + DY[0];
-          int lx = nx + DX[0];
-          int ry = ny + DY[2];
-          int rx = nx + DX[2];
-
-          if(is_inside(ly, lx) && is_inside(ry, rx)){
-            if((g_maze[ly][lx] == WALL) ^ (g_maze[ry][rx] == WALL)){
-              if(g_maze[ly][lx] == WALL){
-                //fprintf(stderr,"%s(%d, %d, %d, depth = %d) go right\n", pad.c_str(), ny, nx, 2, depth);
-                slip(color, ny, nx, 2, depth+1, check_list);
-              }else{
-                //fprintf(stderr,"%s(%d, %d, %d, depth = %d) go left\n", pad.c_str(), ny, nx, 0, depth);
-                slip(color, ny, nx, 0, depth+1, check_list);
-              }
+     * 親ノードの区間[begin, end)を展開して子ノードの候補を作業領域に溜める
+     * g_mazeやg_ball_bitsは書き換えないので複数のスレッドから同時に呼び出せる
+     * @param thread_id スレッド番号
+     * @param parents 親ノードの一覧
+     * @param depth 親ノードの深さ
+     * @param root_node rootのノード
+     * @param search_ball_ids 探索対象のボールのID
+     */
+    void expand_nodes(int thread_id, const vector<NODE> &parents, int begin, int end, const NODE &root_node, const int *search_ball_ids){
+      WORKER &worker = g_worker_list[thread_id];
+      worker.candidates.clear();
+      worker.check_list.clear();
+      worker.duplicate_count = 0;
+
+      for(int parent_id = begin; parent_id < end; parent_id++){
+        // 親の盤面を取得
+        const NODE &parent = parents[parent_id];
+
+        restore_board(worker.ball_bits, root_node, parent);
+
+        for(int i = 0; i < g_search_ball_count; i++){
+          int ball_id = search_ball_ids[i];
+          int color = get_ball(ball_id)->color;
+          int y = parent.ball_y[i];
+          int x = parent.ball_x[i];
+
+          // 4方向にコロコロ
+          for(int direct = 0; direct < 4; direct++){
+            COORD coord = roll_ball(worker.ball_bits, y, x, direct);
+
+            // ボールが1マスも進んでいない場合は処理を飛ばす
+            if(coord.y == y && coord.x == x) continue;
+
+            // ハッシュ値を再計算
+            ll new_hash = update_zoblish_hash(parent.hash, y, x, color, coord.y, coord.x, color);
+
+            // 既に調べた盤面以外は評価を行わない(以前の深さとの重複は後でまとめて調べる)
+            if(g_check_list.contains(new_hash) || !worker.check_list.insert(new_hash)){
+              worker.duplicate_count += 1;
+              continue;
             }
-          }else if(is_outside(ly, lx) && g_maze[ry][rx] == EMPTY){
-            //fprintf(stderr,"%s(%d, %d, %d, depth = %d) go right\n", pad.c_str(), ny, nx, 2, depth);
-            slip(color, ny, nx, 2, depth+1, check_list);
-          }else if(is_outside(ry, rx) && g_maze[ly][lx] == EMPTY){
-            //fprintf(stderr,"%s(%d, %d, %d, depth = %d) go left\n", pad.c_str(), ny, nx, 0, depth);
-            slip(color, ny, nx, 0, depth+1, check_list);
+
+            // 子ノードの候補を作成(ノードにするのはビームに残った時だけ)
+            CANDIDATE candidate;
+            candidate.parent = parent_id;
+            candidate.index = i;
+            candidate.direct = direct;
+            candidate.to_y = coord.y;
+            candidate.to_x = coord.x;
+            candidate.hash = new_hash;
+            candidate.score = update_score(parent.score, color, y, x, coord.y, coord.x);
+            candidate.eval = update_eval(parent.eval, ball_id, color, y, x, coord.y, coord.x);
+
+            // 候補に追加
+            worker.candidates.push_back(candidate);
           }
         }
 
-        g_eval_field[ny][nx][color] += 1;
-
-        ny += DY[direct];
-        nx += DX[direct];
+        // 親の盤面からrootの盤面に戻す
+        restore_board(worker.ball_bits, parent, root_node);
       }
-      ny -= DY[direct];
-      nx -= DX[direct];
+    }
+
+    /**
+     * スレッドプールの全てのスレッドでtaskを実行する(init()でスレッド数はg_thread_countに揃えてある)
+     *   区間の計測は呼び出し元(0番目)のスレッドの分しか数えないので、
+     *   それ以外のスレッドのハードウェアカウンタの値はここで数えてphaseの区間に加える
+     * @param phase 計測する区間
+     * @param task スレッド番号を受け取る関数
+     */
+    void run_workers(int phase, const function<void(int)> &task){
+      bool perf = g_stats_active && g_perf_available;
+
+      g_thread_pool.run([&](int thread_id){
+        if(thread_id == 0 || !perf){
+          task(thread_id);
+          return;
+        }
+
+        // カウンタは開いたスレッドの分だけを数えるので、このスレッドで開く
+        WORKER &worker = g_worker_list[thread_id];
+        if(!worker.perf_counter){
+          worker.perf_counter.reset(new PERF_COUNTER());
+          worker.perf_counter->open_all();
+        }
+
+        PERF_VALUES before, after;
+        worker.perf_counter->read_all(before);
+        task(thread_id);
+        worker.perf_counter->read_all(after);
+
+        for(int event = 0; event < PERF_EVENT_COUNT; event++){
+          bool known = before.value[event] >= 0 && after.value[event] >= 0;
+          worker.perf.value[event] = (known)? after.value[event] - before.value[event] : UNKNOWN;
+        }
+      });
+
+      if(!perf) return;
 
-      // 1マスも動かないなら再帰を抜ける
-      if(y == ny && x == nx){
-        //fprintf(stderr,"%s(%d, %d, %d) slip end(no move)\n", pad.c_str(), ny, nx, direct);
-        return;
+      for(int thread_id = 1; thread_id < g_thread_count; thread_id++){
+        for(int event = 0; event < PERF_EVENT_COUNT; event++){
+          ll &value = g_stats.phase_perf[phase].value[event];
+          ll worker_value = g_worker_list[thread_id].perf.value[event];
+          // 一度でも読めなかったイベントは-1のままにする
+          value = (value < 0 || worker_value < 0)? UNKNOWN : value + worker_value;
+        }
       }
+    }
+
+    /**
+     * 自由形式の結果を標準エラー出力に表示するかどうか
+     *   統計情報のJSON Linesに混ざらないように、統計情報を出力する場合は表示しない
+     */
+    bool is_verbose(){
+      return g_verbose && !g_stats_enabled && !g_perf_enabled;
+    }
 
-      // 評価値を上げる
-      g_eval_field[ny][nx][color] += (g_slip_limit - depth);
-      //fprintf(stderr,"(%d, %d) stop\n", ny, nx);
+    /**
+     * 区間の計測を開始する(統計情報を取らない場合は時計もカウンタも読まない)
+     * @return 開始時の状態
+     */
+    inline PHASE_MARK start_phase(){
+      PHASE_MARK mark;
 
-      for(int nd = 0; nd < 4; nd++){
-        // 逆方向には滑らない
-        if(nd % 2 == direct % 2) continue;
+      if(g_stats_active){
+        if(g_perf_available) g_perf_counter.read_all(mark.perf);
+        mark.time = chrono::steady_clock::now();
+      }
 
-        int nny = ny + DY[nd];
-        int nnx = nx + DX[nd];
+      return mark;
+    }
 
-        if(is_outside(nny,nnx) || g_maze[nny][nnx] == WALL){
-          //fprintf(stderr,"%s(%d, %d, %d) next slip start =>\n", pad.c_str(), ny, nx, nd);
-          slip(color, ny, nx, (nd+2)&3, depth+1, check_list);
+    /**
+     * 区間の計測を終了して統計情報に加える
+     * @param phase 区間
+     * @param start 開始時の状態
+     */
+    inline void end_phase(int phase, const PHASE_MARK &start){
+      if(!g_stats_active) return;
+      g_stats.phase_time[phase] += chrono::duration<double, milli>(chrono::steady_clock::now() - start.time).count();
+
+      if(g_perf_available){
+        PERF_VALUES current;
+        g_perf_counter.read_all(current);
+
+        for(int event = 0; event < PERF_EVENT_COUNT; event++){
+          ll &value = g_stats.phase_perf[phase].value[event];
+          // 一度でも読めなかったイベントは-1のままにする
+          if(value < 0 || current.value[event] < 0 || start.perf.value[event] < 0){
+            value = UNKNOWN;
+          }else{
+            value += current.value[event] - start.perf.value[event];
+          }
         }
       }
     }
 
+    /**
+     * 探索対象のボールをfromの位置からtoの位置に置き直す
+     * (探索中はボールの位置をビットボードだけで管理する)
+     * @param ball_bits 書き換えるビットボード
+     * @param from 現在の盤面のノード
+     * @param to 復元したい盤面のノード
+     */
+    void restore_board(BITBOARD &ball_bits, const NODE &from, const NODE &to){
+      for(int i = 0; i < g_search_ball_count; i++){
+        ball_bits.reset(from.ball_y[i], from.ball_x[i]);
+      }
+      for(int i = 0; i < g_search_ball_count; i++){
+        ball_bits.set(to.ball_y[i], to.ball_x[i]);
+      }
+    }
+
+    /**
+     * ボールを転がす
+     * 壁で止まる位置は事前計算した表から、ボールで止まる位置はビット演算で求める
+     * @param ball_bits ボールの位置
+     * @param y y座標
+     * @param x x座標
+     * @param direct 転がす方向
+     * @return coord 転がした後のボールの位置
+     */
+    inline COORD roll_ball(const BITBOARD &ball_bits, int y, int x, int direct){
+      int stop = g_wall_stop[y][x][direct];
+      unsigned long long mask;
+
+      switch(direct){
+        case 0:
+          mask = ball_bits.row[y] & ((1ULL << x) - 1);
+          if(mask) stop = max(stop, 64 - __builtin_clzll(mask));
+          return COORD(y, stop);
+        case 1:
+          mask = ball_bits.col[x] & ~((2ULL << y) - 1);
+          if(mask) stop = min(stop, __builtin_ctzll(mask) - 1);
+          return COORD(stop, x);
+        case 2:
+          mask = ball_bits.row[y] & ~((2ULL << x) - 1);
+          if(mask) stop = min(stop, __builtin_ctzll(mask) - 1);
+          return COORD(y, stop);
+        default:
+          mask = ball_bits.col[x] & ((1ULL << y) - 1);
+          if(mask) stop = max(stop, 64 - __builtin_clzll(mask));
+          return COORD(stop, x);
+      }
+    }
+
+    /**
+     * 現在の盤面でボールを転がす
+     */
+    inline COORD roll_ball(int y, int x, int direct){
+      return roll_ball(g_ball_bits, y, x, direct);
+    }
+
     /**
      * ビーム幅を決める
      */
@@ -600,6 +2303,66 @@ class RollingBalls {
         g_beam_depth = 2;
         g_search_ball_count = min(g_total_ball_count, 20);
       }
+
+      g_beam_range = max(1, g_beam_range * g_beam_range_percent / 100);
+      // 同じボールを2回調べないようにボールの総数で抑える
+      g_search_ball_count = min(g_search_ball_count, g_total_ball_count);
+    }
+
+    /**
+     * 直近の手で実際にかかった時間から、残りの手数が残り時間に収まるように
+     * 探索対象のボールの数とビーム幅を調整する
+     *   深さ1のノードは ボールの数*4 個しかないので、ビーム幅をそれ以上にしても展開数は増えない
+     *   1手の展開数はおよそ ボールの数^2 に比例するので、ボールの数で時間を合わせる
+     * @param move_count 確定した手数
+     * @param move_limit 手数の上限
+     * @param current_time 現在の時刻
+     * @param end_time 終了時刻
+     */
+    void adjust_beam_config(int move_count, int move_limit, ll current_time, ll end_time){
+      double used_time = current_time - g_control_time;
+      double time_per_move = used_time / (move_count - g_control_move);
+      double budget_per_move = 0.95 * (end_time - current_time) / max(1, move_limit - move_count);
+
+      // 1回で大きく変えすぎないように抑える
+      double ratio = min(1.5, max(0.5, budget_per_move / time_per_move));
+      int max_ball_count = min(g_total_ball_count, MAX_SEARCH_BALL_COUNT);
+      int ball_count = min(max_ball_count, max(1, (int)(g_search_ball_count * sqrt(ratio) + 0.5)));
+
+      int beam_depth = g_beam_depth;
+      int beam_range = max(g_beam_range, 4 * ball_count);
+
+      // ボールを増やしきっても時間が余る場合は1手深く読んで、その後はビーム幅を広げる
+      if(ball_count == max_ball_count && ratio >= 1.5){
+        if(beam_depth < g_max_beam_depth){
+          beam_depth += 1;
+        }else{
+          beam_range = min(g_max_beam_range, (int)(beam_range * ratio));
+        }
+      }else if(ratio < 1.0 && beam_depth > 2){
+        // 時間が足りない場合は広げたビーム幅から戻す
+        beam_range = (int)(beam_range * ratio);
+        if(beam_range < 4 * ball_count){
+          beam_range = 4 * ball_count;
+          beam_depth -= 1;
+        }
+      }
+
+      if(g_stats_active){
+        flockfile(g_stats_output);
+        fprintf(g_stats_output, "{\"type\": \"control\", \"label\": \"%s\", \"move\": %d, \"nodes_per_sec\": %.0f, "
+            "\"ms_per_move\": %.3f, \"budget_ms_per_move\": %.3f, \"balls\": [%d, %d], \"beam_depth\": [%d, %d], \"beam_range\": [%d, %d]}\n",
+            escape_json(g_stats_label).c_str(), move_count, 1000.0 * (g_generated_node_count - g_control_node_count) / used_time,
+            time_per_move, budget_per_move, g_search_ball_count, ball_count, g_beam_depth, beam_depth, g_beam_range, beam_range);
+        funlockfile(g_stats_output);
+      }
+
+      g_search_ball_count = ball_count;
+      g_beam_depth = beam_depth;
+      g_beam_range = beam_range;
+      g_control_move = move_count;
+      g_control_time = current_time;
+      g_control_node_count = g_generated_node_count;
     }
 
     /**
@@ -611,22 +2374,160 @@ class RollingBalls {
      */
     void roll(int ball_id, int y, int x, int direct){
       BALL *ball = get_ball(ball_id);
-      int ny = y + DY[direct];
-      int nx = x + DX[direct];
+      int color = ball->color;
+
+      // 割当は同じ色のボールの分だけ入れ替わるので、その色の分を引いてから足し直す
+      g_board_eval -= g_eval_field[color][getZ(y, x)] + get_color_assignment_eval(color);
+      g_eval_field[color][getZ(y, x)] -= 100;
+
+      COORD coord = roll_ball(y, x, direct);
+      int ny = coord.y;
+      int nx = coord.x;
+      bool from_open = is_open_target(getZ(y, x));
+      bool to_open = is_open_target(getZ(ny, nx));
+
+      swap(g_maze[getZ(y, x)], g_maze[getZ(ny, nx)]);
+      g_ball_cell[getZ(y, x)] = UNKNOWN;
+      g_ball_cell[getZ(ny, nx)] = ball_id;
+      g_ball_bits.move(y, x, ny, nx);
+      ball->y = ny;
+      ball->x = nx;
+
+      update_assignment(ball_id);
+
+      g_board_eval += g_eval_field[color][getZ(ny, nx)] + get_color_assignment_eval(color);
+      g_board_score = update_score(g_board_score, color, y, x, ny, nx);
+      g_board_point = update_point(g_board_point, color, y, x, ny, nx);
+      g_board_hash = update_zoblish_hash(g_board_hash, y, x, color, ny, nx, color);
+      update_open_target(getZ(y, x), from_open);
+      update_open_target(getZ(ny, nx), to_open);
+      g_ball_index.set(ball_id, get_ball_class(ball_id));
+    }
+
+    /**
+     * ボールの状態の分類を求める
+     * @param ball_id ボールのID
+     */
+    int get_ball_class(int ball_id){
+      BALL *ball = get_ball(ball_id);
+      int z = getZ(ball->y, ball->x);
+      int target_color = g_target[z];
+
+      if(target_color == ball->color) return BALL_SETTLED;
+      if(target_color < WALL) return BALL_BLOCKING;
+      if(g_open_target_count[g_segment_id[z][0]] > 0 || g_open_target_count[g_segment_id[z][1]] > 0) return BALL_IN_PATH;
+      if(g_roll_distance[z][ball->color] <= g_roll_distance_limit) return BALL_NEAR;
+      return BALL_FAR;
+    }
+
+    /**
+     * 全てのボールを状態ごとの組に分ける(g_roll_distanceを求めた後に呼ぶ)
+     */
+    void init_ball_index(){
+      init_path_segment();
+      g_ball_index.init(g_total_ball_count);
+
+      for(int ball_id = 0; ball_id < g_total_ball_count; ball_id++){
+        g_ball_index.set(ball_id, get_ball_class(ball_id));
+      }
+    }
 
-      g_eval_field[ball->y][ball->x][ball->color] -= 100;
+    /**
+     * 壁で区切られた横と縦の区間に番号を付けて、区間ごとに空いている目標地点を数える
+     */
+    void init_path_segment(){
+      int segment_count = 0;
 
-      while(is_inside(ny, nx) && g_maze[ny][nx] == EMPTY){
-        ny += DY[direct];
-        nx += DX[direct];
+      for(int z = 0; z < g_cell_count; z++){
+        g_ball_cell[z] = UNKNOWN;
+      }
+      for(int ball_id = 0; ball_id < g_total_ball_count; ball_id++){
+        g_ball_cell[getZ(get_ball(ball_id)->y, get_ball(ball_id)->x)] = ball_id;
       }
 
-      ny -= DY[direct];
-      nx -= DX[direct];
+      for(int axis = 0; axis < 2; axis++){
+        // 左(横の区間)か上(縦の区間)のセルが壁なら新しい区間になる
+        int prev_dz = g_dz[(axis == 0)? 0 : 3];
 
-      swap(g_maze[y][x], g_maze[ny][nx]);
-      ball->y = ny;
-      ball->x = nx;
+        for(int y = 0; y < g_height; y++){
+          for(int x = 0; x < g_width; x++){
+            int z = getZ(y, x);
+            if(g_maze[z] == WALL) continue;
+
+            g_segment_id[z][axis] = (g_maze[z + prev_dz] == WALL)? segment_count++ : g_segment_id[z + prev_dz][axis];
+          }
+        }
+      }
+
+      g_open_target_count.assign(segment_count, 0);
+      for(int i = 0; i < g_target_list.size(); i++){
+        int z = getZ(g_target_list[i].y, g_target_list[i].x);
+        if(!is_open_target(z)) continue;
+
+        g_open_target_count[g_segment_id[z][0]] += 1;
+        g_open_target_count[g_segment_id[z][1]] += 1;
+      }
+    }
+
+    /**
+     * 同じ色のボールが乗っていない目標地点かどうか
+     */
+    inline bool is_open_target(int z){
+      return g_target[z] < WALL && g_maze[z] != g_target[z];
+    }
+
+    /**
+     * 目標地点の空き具合が変わった時に区間の数を直し、
+     * 空いている目標地点の有無が変わった区間にあるボールの分類を求め直す
+     * @param z セル
+     * @param was_open 変わる前に空いていたかどうか
+     */
+    void update_open_target(int z, bool was_open){
+      bool open = is_open_target(z);
+      if(open == was_open) return;
+
+      for(int axis = 0; axis < 2; axis++){
+        int &count = g_open_target_count[g_segment_id[z][axis]];
+        count += (open)? 1 : -1;
+        if(count > 1 || (count == 1 && !open)) continue;
+
+        // 区間の両端の壁まで辿る(方向はaxisとaxis+2)
+        for(int direct = axis; direct < 4; direct += 2){
+          for(int nz = z; g_maze[nz] != WALL; nz += g_dz[direct]){
+            if(g_maze[nz] < WALL) g_ball_index.set(g_ball_cell[nz], get_ball_class(g_ball_cell[nz]));
+          }
+        }
+      }
+    }
+
+    /**
+     * 探索対象のボールを選ぶ
+     *   組の重み×残りの個数に比例して組を選び、その中から重複しないように1個ずつ取り出す
+     *   (取り出したボールは組の先頭に寄せていくので、組の中の並びが変わるだけで済む)
+     * @param ball_ids 選んだボールのIDを入れる配列
+     * @param count 選ぶ数
+     */
+    void select_search_balls(int *ball_ids, int count){
+      int taken[BALL_CLASS_COUNT] = {};
+
+      for(int i = 0; i < count; i++){
+        int total_weight = 0;
+        for(int cls = 0; cls < BALL_CLASS_COUNT; cls++){
+          total_weight += g_ball_class_weight[cls] * (g_ball_index.members[cls].size() - taken[cls]);
+        }
+
+        int r = xor128() % total_weight;
+        int cls = 0;
+        while(r >= g_ball_class_weight[cls] * (int)(g_ball_index.members[cls].size() - taken[cls])){
+          r -= g_ball_class_weight[cls] * (g_ball_index.members[cls].size() - taken[cls]);
+          cls += 1;
+        }
+
+        int rest = g_ball_index.members[cls].size() - taken[cls];
+        g_ball_index.swap_members(cls, taken[cls], taken[cls] + xor128() % rest);
+        ball_ids[i] = g_ball_index.members[cls][taken[cls]];
+        taken[cls] += 1;
+      }
     }
 
     /**
@@ -635,8 +2536,8 @@ class RollingBalls {
      * @param x x座標
      */
     int get_point(int y, int x){
-      int color = g_maze[y][x];
-      int target_color = g_target[y][x];
+      int color = g_maze[getZ(y, x)];
+      int target_color = g_target[getZ(y, x)];
 
       if(is_ball(color) && is_ball(target_color)){
         return (color == target_color)? g_main_score : g_sub_score;
@@ -653,7 +2554,7 @@ class RollingBalls {
      */
     void point_up(int y, int x, int point){
       for(int c = 0; c < g_ball_type_count; c++){
-        g_eval_field[y][x][c] += point;
+        g_eval_field[c][getZ(y, x)] += point;
       }
     }
 
@@ -662,7 +2563,7 @@ class RollingBalls {
      */
     void point_down(int y, int x, int point){
       for(int c = 0; c < g_ball_type_count; c++){
-        g_eval_field[y][x][c] -= point;
+        g_eval_field[c][getZ(y, x)] -= point;
       }
     }
 
@@ -671,41 +2572,27 @@ class RollingBalls {
      * @return score スコア
      */
     int get_score(){
-      int score = 0;
-
-      for(int y = 0; y < g_height; y++){
-        for(int x = 0; x < g_width; x++){
-          int color = g_maze[y][x];
-          int target_color = g_target[y][x];
-
-          if(is_ball(color) && is_ball(target_color)){
-            if(color == target_color){
-              score += g_main_score;
-            }else{
-              score += g_sub_score;
-            }
-          }
-        }
-      }
+      int match_count, ball_count;
+      count_target_cells(g_board_kernel, g_maze, g_target, g_cell_count, match_count, ball_count);
 
-      return score;
+      return match_count * g_main_score + (ball_count - match_count) * g_sub_score;
     }
 
     /**
      * スコアの差分更新を行う
+     * @param score 移動前のスコア
+     * @param color 移動させたボールの色
      */
-    int update_score(int score, int y1, int x1, int y2, int x2){
-      int s1 = g_maze[y2][x2];
-      int s2 = g_target[y1][x1];
-      int s3 = g_maze[y2][x2];
-      int s4 = g_target[y2][x2];
+    int update_score(int score, int color, int y1, int x1, int y2, int x2){
+      int t1 = g_target[getZ(y1, x1)];
+      int t2 = g_target[getZ(y2, x2)];
 
-      if(is_ball(s1) && is_ball(s2)){
-        score -= (s1 == s2)? g_main_score : g_sub_score;
+      if(is_ball(t1)){
+        score -= (color == t1)? g_main_score : g_sub_score;
       }
 
-      if(is_ball(s3) && is_ball(s4)){
-        score += (s3 == s4)? g_main_score : g_sub_score;
+      if(is_ball(t2)){
+        score += (color == t2)? g_main_score : g_sub_score;
       }
 
       return score;
@@ -716,25 +2603,54 @@ class RollingBalls {
      * @return eval 評価値
      */
     int get_eval(){
+      int eval = sum_eval_planes(g_board_kernel, g_maze, g_eval_field, g_cell_count, g_color_count);
+
+      for(int ball_id = 0; ball_id < g_total_ball_count; ball_id++){
+        BALL *ball = get_ball(ball_id);
+        eval += get_assignment_eval(ball_id, ball->y, ball->x);
+      }
+
+      return eval;
+    }
+
+    /**
+     * 同じ色のボール全体の割り当てられた目標地点への近さによる評価値
+     * @param color 色
+     */
+    int get_color_assignment_eval(int color){
+      ASSIGNMENT *assignment = &g_assignment_list[color];
       int eval = 0;
 
-      for(int y = 0; y < g_height; y++){
-        for(int x = 0; x < g_width; x++){
-          int color = g_maze[y][x];
+      for(int row = 1; row <= assignment->size; row++){
+        int ball_id = assignment->ball_ids[row];
+        if(ball_id == UNKNOWN) continue;
 
-          if(is_not_ball(color)) continue;
-          eval += g_eval_field[y][x][color];
-        }
+        BALL *ball = get_ball(ball_id);
+        eval += get_assignment_eval(ball_id, ball->y, ball->x);
       }
 
       return eval;
     }
 
+    /**
+     * 割り当てられた目標地点への近さによる評価値
+     * @param ball_id ボールのID
+     * @param y y座標
+     * @param x x座標
+     */
+    inline int get_assignment_eval(int ball_id, int y, int x){
+      int target_id = get_ball(ball_id)->target_id;
+      if(target_id == UNKNOWN) return 0;
+
+      return -g_assignment_weight * get_target_dist(target_id, y, x);
+    }
+
     /**
      * 評価値の差分更新を行う
      */
-    inline int update_eval(int eval, int color, int y1, int x1, int y2, int x2){
-      eval += (g_eval_field[y2][x2][color] - g_eval_field[y1][x1][color]);
+    inline int update_eval(int eval, int ball_id, int color, int y1, int x1, int y2, int x2){
+      eval += (g_eval_field[color][getZ(y2, x2)] - g_eval_field[color][getZ(y1, x1)]);
+      eval += (get_assignment_eval(ball_id, y2, x2) - get_assignment_eval(ball_id, y1, x1));
       return eval;
     }
 
@@ -747,88 +2663,145 @@ class RollingBalls {
 
       for(int y = 0; y < g_height; y++){
         for(int x = 0; x < g_width; x++){
-          int color = g_target[y][x];
+          int color = g_target[getZ(y, x)];
 
           if(is_not_ball(color)) continue;
 
-          g_eval_field[y][x][color] += 100;
+          g_eval_field[color][getZ(y, x)] += 100;
           // ゴールの周りのセルも評価値を上げる
           check_around_cell(y,x,color);
+        }
+      }
 
-          for(int direct = 0; direct < 4; direct++){
-            int ny = y + DY[direct];
-            int nx = x + DX[direct];
-
-            // 壁の場合反対側に滑りだして再帰的に評価値をつけていく
-            if(is_outside(ny,nx) || g_maze[ny][nx] == WALL){
-              //fprintf(stderr,"(%d, %d, %d) slip start =>\n", y, x, (direct+2)&3);
-              map<int, bool> check_list;
-              slip(color, y, x, (direct+2)&3, 0, check_list);
-            }
+      init_roll_distance();
+
+      // 目的地まで少ない回数で転がせるセルほど評価値を上げる
+      for(int y = 0; y < g_height; y++){
+        for(int x = 0; x < g_width; x++){
+          for(int color = 0; color < 10; color++){
+            int dist = g_roll_distance[getZ(y, x)][color];
+
+            if(dist == 0 || dist > g_roll_distance_limit) continue;
+            g_eval_field[color][getZ(y, x)] += 4 * (g_roll_distance_limit - dist + 1);
           }
         }
       }
     }
 
     /**
-     * 周りのセルを調べて空白地点ならポイントを少し上げる
-     * @param y y座標
-     * @param x x座標
+     * 壁だけを障害物とみなして、各色の目的地までの最小転がし回数を求める
+     * (目的地から逆向きに辿る多始点BFS)
      */
-    void check_around_cell(int y, int x, int color, int point = 0){
-      queue<COORD> que;
-      int dist_limit = 2;
+    void init_roll_distance(){
+      memset(g_roll_distance, UNREACHABLE, sizeof(g_roll_distance));
 
-      que.push(COORD(y,x));
+      // 色ごとに独立しているので、スレッドごとに別の色を受け持つ
+      if(g_thread_count == 1){
+        for(int color = 0; color < 10; color++){
+          init_color_roll_distance(color, g_worker_list[0].cell_queue);
+        }
+      }else{
+        run_workers(PHASE_INIT, [&](int thread_id){
+          for(int color = thread_id; color < 10; color += g_thread_count){
+            init_color_roll_distance(color, g_worker_list[thread_id].cell_queue);
+          }
+        });
+      }
+    }
 
-      while(!que.empty()){
-        COORD coord = que.front(); que.pop();
+    /**
+     * 1色分の目的地までの最小転がし回数を求める
+     *   書き込むのはg_roll_distanceのこの色の分だけなので、別の色と同時に呼び出せる
+     * @param color 色
+     * @param que 幅優先探索のキュー
+     */
+    void init_color_roll_distance(int color, int *que){
+      int head = 0;
+      int tail = 0;
 
-        if(coord.dist >= dist_limit) continue;
+      for(int i = 0; i < g_target_list.size(); i++){
+        TARGET *target = &g_target_list[i];
+        if(target->color != color) continue;
 
-        for(int direct = 0; direct < 4; direct++){
-          int ny = coord.y + DY[direct];
-          int nx = coord.x + DX[direct];
+        int z = getZ(target->y, target->x);
+        g_roll_distance[z][color] = 0;
+        que[tail++] = z;
+      }
 
-          if(is_inside(ny, nx) && g_maze[ny][nx] == EMPTY){
+      while(head < tail){
+        int z = que[head++];
+        int dist = g_roll_distance[z][color];
 
-            g_eval_field[ny][nx][color] += (dist_limit - coord.dist + point);
-            que.push(COORD(ny,nx,coord.dist+1));
+        for(int direct = 0; direct < 4; direct++){
+          // directの方向に転がしてこのセルで止まるのは先が壁(もしくは枠)の場合だけ
+          if(g_maze[z + g_dz[direct]] != WALL) continue;
+
+          // 逆方向に壁まで戻ったセルはどこから転がしてもこのセルで止まる
+          for(int nz = z - g_dz[direct]; g_maze[nz] != WALL; nz -= g_dz[direct]){
+            if(g_roll_distance[nz][color] == UNREACHABLE){
+              g_roll_distance[nz][color] = dist + 1;
+              que[tail++] = nz;
+            }
           }
         }
       }
     }
 
     /**
-     * フィールドの内側かどうかを判定
-     * @param y y座標
-     * @param x x座標
-     * @return (true: 内側, false: 外側)
+     * 壁だけを障害物とみなして、各セルから1つの目標地点まで転がす最小回数を求める
+     * (init_roll_distanceと同じ逆向きのBFSを目標地点1つから行う)
+     * @param target_id 目標地点のID
+     * @param que 幅優先探索のキュー
      */
-    inline bool is_inside(int y, int x){
-      return (0 <= y && y < g_height && 0 <= x && x < g_width);
-    }
+    void init_target_distance(int target_id, int *que){
+      unsigned char *distance = &g_target_distance[target_id * g_cell_count];
+      TARGET *target = get_target(target_id);
+      int head = 0;
+      int tail = 0;
 
-    /**
-     * ノードを作成する
-     * @return NODE
-     */
-    inline NODE create_node(){
-      NODE node;
+      memset(distance, UNREACHABLE, g_cell_count);
+      distance[getZ(target->y, target->x)] = 0;
+      que[tail++] = getZ(target->y, target->x);
+
+      while(head < tail){
+        int z = que[head++];
 
-      memcpy(node.maze, g_maze, sizeof(g_maze));
+        for(int direct = 0; direct < 4; direct++){
+          // directの方向に転がしてこのセルで止まるのは先が壁(もしくは枠)の場合だけ
+          if(g_maze[z + g_dz[direct]] != WALL) continue;
 
-      return node;
+          for(int nz = z - g_dz[direct]; g_maze[nz] != WALL; nz -= g_dz[direct]){
+            if(distance[nz] == UNREACHABLE){
+              distance[nz] = distance[z] + 1;
+              que[tail++] = nz;
+            }
+          }
+        }
+      }
     }
 
     /**
-     * フィールドの外側かどうかを判定
+     * 周りのセルを調べて空白地点ならポイントを少し上げる
+     *   空白を通って2マス先までの経路ごとに、1マス目は2、2マス目は1を足す
+     *   (深さが2で決まっているので、キューを使わずに2重ループで辿る)
      * @param y y座標
      * @param x x座標
-     * @return (true: 外側, false: 内側)
      */
-    inline bool is_outside(int y, int x){
-      return (y < 0 || g_height <= y || x < 0 || g_width <= x);
+    void check_around_cell(int y, int x, int color, int point = 0){
+      int z = getZ(y, x);
+
+      for(int direct = 0; direct < 4; direct++){
+        int nz = z + g_dz[direct];
+
+        // 外側は番兵の壁なので範囲の判定はいらない
+        if(g_maze[nz] != EMPTY) continue;
+        g_eval_field[color][nz] += 2 + point;
+
+        for(int next_direct = 0; next_direct < 4; next_direct++){
+          int nnz = nz + g_dz[next_direct];
+          if(g_maze[nnz] == EMPTY) g_eval_field[color][nnz] += 1 + point;
+        }
+      }
     }
 
     /**
@@ -849,11 +2822,14 @@ class RollingBalls {
 
     /**
      * 目標地点までの距離を取得する
+     *   壁だけを考えて転がす回数をg_assignment_roll_weight倍してマンハッタン距離に足す
+     *   (壁に接していない目標地点には転がすだけでは届かないので、回数はg_roll_distance_limit+1で打ち切る)
      */
     int get_target_dist(int target_id, int y, int x){
       TARGET *target = get_target(target_id);
+      int roll_count = min((int)g_target_distance[target_id * g_cell_count + getZ(y, x)], g_roll_distance_limit + 1);
 
-      return abs(target->y - y) + abs(target->x - x);
+      return g_assignment_roll_weight * roll_count + abs(target->y - y) + abs(target->x - x);
     }
 
     /**
@@ -893,24 +2869,33 @@ class RollingBalls {
     }
 
     /**
-     * 壁かどうかを判定する
+     * 1次元の座標の取得(番兵の枠の分だけずらしている)
+     * 枠の上の y = -1, g_height や x = -1, g_width も指定できる
+     * @param y y座標
+     * @param x x座標
+     * @return 1次元にした結果の座標
+     */
+    inline int getZ(int y, int x){
+      return (y + 1) * g_stride + (x + 1);
+    }
+
+    /**
+     * 壁かどうかを判定する(番兵の枠も壁として扱う)
      * @param y y座標
      * @param x x座標
      * @return (true: 壁, false: not 壁)
      */
     inline bool is_wall(int y, int x){
-      return (is_outside(y, x) || g_maze[y][x] == WALL);
+      return (g_maze[getZ(y, x)] == WALL);
     }
 
     /**
      * zoblish hash用の値を初期化する
      */
     void init_zoblish_field(){
-      for(int y = 0; y < MAX_HEIGHT; y++){
-        for(int x = 0; x < MAX_WIDTH; x++){
-          for(int status = 0; status < MAX_STATUS; status++){
-            g_zoblish_field[y][x][status] = xor128();
-          }
+      for(int z = 0; z < MAX_CELL; z++){
+        for(int status = 0; status < MAX_STATUS; status++){
+          g_zoblish_field[z][status] = xor128();
         }
       }
     }
@@ -921,19 +2906,7 @@ class RollingBalls {
      * @return ハッシュ値
      */
     ll get_zoblish_hash(){
-      ll hash = 0;
-
-      for(int y = 0; y < g_height; y++){
-        for(int x = 0; x < g_width; x++){
-          int color = g_maze[y][x];
-
-          if(is_ball(color)){
-            hash ^= g_zoblish_field[y][x][color];
-          }
-        }
-      }
-
-      return hash;
+      return xor_zoblish(g_board_kernel, g_maze, g_zoblish_field, g_cell_count);
     }
 
     /**
@@ -948,9 +2921,9 @@ class RollingBalls {
      */
     inline ll update_zoblish_hash(ll hash, int y1, int x1, int c1, int y2, int x2, int c2){
       // 移動前のボールの位置を消して
-      hash ^= g_zoblish_field[y1][x1][c1];
+      hash ^= g_zoblish_field[getZ(y1, x1)][c1];
       // 移動後のボールの位置に入れてあげる
-      hash ^= g_zoblish_field[y2][x2][c2];
+      hash ^= g_zoblish_field[getZ(y2, x2)][c2];
 
       return hash;
     }
@@ -970,16 +2943,37 @@ class RollingBalls {
     }
 };
 
-int main(){
-  g_time_limit = 2000;
+// 他のツールからライブラリとして読み込む場合はmainを定義しない
+#ifndef ROLLING_BALLS_LIBRARY
+int main(int argc, char *argv[]){
+  RollingBalls rb;
+  rb.g_time_limit = 2000;
+
+  // -thread N でビームサーチの展開に使うスレッド数を指定する
+  // -stats で探索の統計情報を標準エラー出力にJSON Linesで出力する
+  // -perf で統計情報にハードウェアカウンタの値を加える
+  // -portfolio N で設定と乱数のシード値を変えたN個のソルバーを同時に動かす(0の場合はCPUのコア数)
+  for(int i = 1; i < argc; i++){
+    if(string(argv[i]) == "-thread" && i+1 < argc){
+      rb.g_thread_count = atoi(argv[i+1]);
+    }else if(string(argv[i]) == "-stats"){
+      rb.g_stats_enabled = true;
+    }else if(string(argv[i]) == "-perf"){
+      rb.g_perf_enabled = true;
+    }else if(string(argv[i]) == "-portfolio" && i+1 < argc){
+      rb.g_portfolio_count = atoi(argv[i+1]);
+      if(rb.g_portfolio_count <= 0) rb.g_portfolio_count = max(1u, thread::hardware_concurrency());
+    }
+  }
+
   int h;string str;vector<string> start, target;
   cin >> h;
   for(int i=0;i<h;i++){cin >> str;start.push_back(str);}
   cin >> h;
   for(int i=0;i<h;i++){cin >> str;target.push_back(str);}
-  RollingBalls rb;
   vector<string> ret = rb.restorePattern(start, target);
   cout << ret.size() << endl;
   for(int i=0;i<ret.size();i++){cout << ret[i] << endl;}
   return 0;
 }
+#endif
@@ -0,0 +1,264 @@
+/**
+ * まとめて問題を解くためのドライバ
+ *
+ * 使い方:
+ *   ./RollingBallsBatch [-dir DIR] [-thread N] [-time MS] [-format csv|json] < cases.txt
+ *   ./RollingBallsBatch -seed S -count N [-size L] [-thread N] [-time MS] [-format csv|json]
+ *
+ *   -dir DIR      DIR以下のファイルを1ファイル1問として読み込む(指定しない場合は標準入力)
+ *   -seed S       ファイルを読まずにシード値 S, S+1, ..., S+N-1 の問題を生成して解く
+ *   -count N      生成する問題の数
+ *   -size L       生成する盤面の大きさを L x L に固定する
+ *   -thread N     同時に解く問題の数(デフォルトはCPUのコア数)
+ *   -time MS      1問あたりの制限時間(ミリ秒)
+ *   -portfolio N  1問ごとに設定と乱数のシード値を変えたN個のソルバーを同時に動かす
+ *   -format FMT   出力形式(csv or json)
+ *   -stats FILE   探索の統計情報をJSON LinesでFILEに書き出す
+ *   -perf         ハードウェアカウンタの値を計測して盤面の大きさの区分ごとに集計する
+ *                 (集計結果は-statsのFILE、指定しない場合は標準エラー出力に書き出す)
+ *
+ * 入力はRollingBalls.cppのmainと同じ形式で、標準入力の場合は問題をそのまま連結したものを読み込む。
+ */
+#define ROLLING_BALLS_LIBRARY
+#include "../RollingBalls.cpp"
+#include "runner.h"
+
+#include <fstream>
+#include <filesystem>
+
+// -perfだけを指定した場合に1手ごとの統計情報を捨てる出力先
+FILE *g_discard_output = NULL;
+
+/**
+ * 1問読み込む
+ * @param in 入力
+ * @param instance 読み込んだ問題
+ * @return (true: 読み込めた, false: 入力の終わり)
+ */
+bool read_instance(istream &in, INSTANCE &instance){
+  int h;
+  string str;
+
+  instance.start.clear();
+  instance.target.clear();
+
+  if(!(in >> h)) return false;
+  for(int i = 0; i < h; i++){ in >> str; instance.start.push_back(str); }
+  if(!(in >> h)) return false;
+  for(int i = 0; i < h; i++){ in >> str; instance.target.push_back(str); }
+
+  return !in.fail();
+}
+
+/**
+ * 問題の一覧を読み込む
+ * @param dir ディレクトリ(空の場合は標準入力)
+ * @return 問題の一覧
+ */
+vector<INSTANCE> read_instance_list(const string &dir){
+  vector<INSTANCE> instance_list;
+  INSTANCE instance;
+
+  if(dir.empty()){
+    while(read_instance(cin, instance)){
+      instance.name = "stdin:" + int2string(instance_list.size());
+      instance_list.push_back(instance);
+    }
+    return instance_list;
+  }
+
+  vector<string> path_list;
+  for(const filesystem::directory_entry &entry : filesystem::directory_iterator(dir)){
+    if(entry.is_regular_file()) path_list.push_back(entry.path().string());
+  }
+  sort(path_list.begin(), path_list.end());
+
+  for(int i = 0; i < path_list.size(); i++){
+    ifstream in(path_list[i]);
+
+    if(read_instance(in, instance)){
+      instance.name = path_list[i];
+      instance_list.push_back(instance);
+    }else{
+      fprintf(stderr, "skip %s (invalid format)\n", path_list[i].c_str());
+    }
+  }
+
+  return instance_list;
+}
+
+/**
+ * 1問解く
+ * @param instance 問題
+ * @param time_limit 制限時間(ms)
+ * @param stats_output 統計情報の出力先(NULLの場合は出力しない)
+ * @param perf_enabled ハードウェアカウンタの値を計測するかどうか
+ * @param portfolio_count 同時に動かすソルバーの数
+ * @return 結果
+ */
+RESULT solve(const INSTANCE &instance, ll time_limit, FILE *stats_output, bool perf_enabled, int portfolio_count){
+  return solve_instance(instance, time_limit, [&](RollingBalls *rb){
+    rb->g_portfolio_count = portfolio_count;
+
+    if(stats_output != NULL){
+      rb->g_stats_enabled = true;
+      rb->g_stats_output = stats_output;
+      rb->g_stats_label = instance.name;
+    }
+    if(perf_enabled){
+      // 集計だけ行う場合は1手ごとの統計情報は捨てる
+      rb->g_perf_enabled = true;
+      if(stats_output == NULL) rb->g_stats_output = g_discard_output;
+    }
+  });
+}
+
+int main(int argc, char *argv[]){
+  string dir = "";
+  string format = "csv";
+  int thread_count = max(1U, thread::hardware_concurrency());
+  ll time_limit = 2000;
+  ll seed = UNKNOWN;
+  int count = 1;
+  int size = 0;
+  FILE *stats_output = NULL;
+  bool perf_enabled = false;
+  int portfolio_count = 1;
+
+  for(int i = 1; i < argc; i += 2){
+    string option = argv[i];
+
+    if(option == "-perf"){
+      perf_enabled = true;
+      i -= 1;
+      continue;
+    }
+    if(i+1 >= argc){
+      fprintf(stderr, "option %s needs a value\n", option.c_str());
+      return 1;
+    }
+
+    if(option == "-dir"){
+      dir = argv[i+1];
+    }else if(option == "-thread"){
+      thread_count = max(1, atoi(argv[i+1]));
+    }else if(option == "-time"){
+      time_limit = atoll(argv[i+1]);
+    }else if(option == "-portfolio"){
+      portfolio_count = max(1, atoi(argv[i+1]));
+    }else if(option == "-format"){
+      format = argv[i+1];
+    }else if(option == "-seed"){
+      seed = atoll(argv[i+1]);
+    }else if(option == "-count"){
+      count = atoi(argv[i+1]);
+    }else if(option == "-size"){
+      size = atoi(argv[i+1]);
+    }else if(option == "-stats"){
+      stats_output = fopen(argv[i+1], "w");
+      if(stats_output == NULL){
+        fprintf(stderr, "can't open %s\n", argv[i+1]);
+        return 1;
+      }
+    }else{
+      fprintf(stderr, "unknown option %s\n", option.c_str());
+      return 1;
+    }
+  }
+
+  vector<INSTANCE> instance_list;
+
+  if(seed == UNKNOWN){
+    instance_list = read_instance_list(dir);
+  }else{
+    for(int i = 0; i < count; i++){
+      instance_list.push_back(GENERATOR::generate(seed + i, size));
+    }
+  }
+  vector<RESULT> result_list(instance_list.size());
+
+  if(perf_enabled && stats_output == NULL){
+    g_discard_output = fopen("/dev/null", "w");
+  }
+  run_parallel(instance_list.size(), thread_count, [&](int id){
+    result_list[id] = solve(instance_list[id], time_limit, stats_output, perf_enabled, portfolio_count);
+  });
+  if(g_discard_output != NULL){
+    fclose(g_discard_output);
+  }
+
+  double total_score = 0.0;
+
+  if(format == "json"){
+    for(int id = 0; id < instance_list.size(); id++){
+      const RESULT &r = result_list[id];
+      printf("{\"name\": \"%s\", \"height\": %d, \"width\": %d, \"balls\": %d, \"valid\": %s, \"score\": %.6f, \"moves\": %d, \"time_ms\": %.1f, \"init_ms\": %.3f}\n",
+          escape_json(instance_list[id].name).c_str(), r.height, r.width, r.ball_count, (r.valid)? "true" : "false", r.score, r.move_count, r.time, r.init_time);
+      total_score += r.score;
+    }
+  }else{
+    printf("name,height,width,balls,valid,score,moves,time_ms,init_ms\n");
+    for(int id = 0; id < instance_list.size(); id++){
+      const RESULT &r = result_list[id];
+      printf("%s,%d,%d,%d,%d,%.6f,%d,%.1f,%.3f\n",
+          instance_list[id].name.c_str(), r.height, r.width, r.ball_count, r.valid, r.score, r.move_count, r.time, r.init_time);
+      total_score += r.score;
+    }
+  }
+
+  const char *size_class_list[3] = {"small", "medium", "large"};
+
+  // ハードウェアカウンタの値を盤面の大きさの区分ごとに集計する
+  if(perf_enabled){
+    FILE *out = (stats_output != NULL)? stats_output : stderr;
+
+    for(int k = 0; k < 3; k++){
+      SEARCH_STATS stats;
+      int count = 0;
+      bool available = true;
+
+      for(int id = 0; id < result_list.size(); id++){
+        const RESULT &r = result_list[id];
+        if(string(get_size_class(r.height * r.width)) != size_class_list[k]) continue;
+        stats.add(r.stats);
+        available = available && r.perf_available;
+        count += 1;
+      }
+      if(count == 0) continue;
+
+      fprintf(out, "{\"type\": \"perf_summary\", \"size_class\": \"%s\", \"instances\": %d, ", size_class_list[k], count);
+      stats.write(out);
+      fprintf(out, ", ");
+      stats.write_perf(out, available);
+      fprintf(out, "}\n");
+    }
+  }
+
+  if(stats_output != NULL){
+    fclose(stats_output);
+  }
+
+  // 初期化にかかった時間を盤面の大きさの区分ごとに集計する
+  for(int k = 0; k < 3; k++){
+    double total_time = 0.0;
+    double max_time = 0.0;
+    int count = 0;
+
+    for(int id = 0; id < result_list.size(); id++){
+      const RESULT &r = result_list[id];
+      if(string(get_size_class(r.height * r.width)) != size_class_list[k]) continue;
+      total_time += r.init_time;
+      max_time = max(max_time, r.init_time);
+      count += 1;
+    }
+    if(count == 0) continue;
+
+    fprintf(stderr, "init %s: instances = %d, average = %.3f ms, max = %.3f ms\n",
+        size_class_list[k], count, total_time / count, max_time);
+  }
+
+  fprintf(stderr, "instances = %d, total score = %f, average = %f\n",
+      (int)instance_list.size(), total_score, total_score / max(1, (int)instance_list.size()));
+
+  return 0;
+}
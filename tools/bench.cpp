@@ -0,0 +1,182 @@
+/**
+ * ソルバーの重い処理を単体で計測するベンチマーク
+ *
+ * 使い方:
+ *   ./RollingBallsBench [-time MS] > bench_result.jsonl
+ *
+ *   -time MS   1つの処理を計測する時間の目安(ミリ秒)
+ *
+ * 20x20, 40x40, 60x60 の固定の盤面(generator.h で生成)に対して各処理の
+ * 1回あたりの時間(ns)、1回あたりのメモリ確保の回数、beam_searchは1秒あたりの生成ノード数を
+ * 1行1件のJSONで出力する。コミット間で差分を取ることを想定している。
+ * 盤面全体を走査する処理(get_score, get_eval, get_zoblish_hash)は
+ * CPUで使える実装(scalar, sse4.1, avx2)ごとに "get_score/avx2" のような名前で出力する。
+ */
+#define ROLLING_BALLS_LIBRARY
+#include "../RollingBalls.cpp"
+#include "generator.h"
+
+#include <atomic>
+#include <chrono>
+#include <new>
+
+// operator newが呼ばれた回数
+atomic<ll> g_allocation_count(0);
+
+void *operator new(size_t size){
+  g_allocation_count++;
+  void *ptr = malloc(size);
+  if(ptr == NULL) throw bad_alloc();
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept{
+  free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept{
+  free(ptr);
+}
+
+// 計測結果
+struct MEASUREMENT {
+  ll op_count;
+  double ns_per_op;
+  double allocations_per_op;
+};
+
+// 最適化で処理が消されないように結果を書き込む先
+volatile ll g_sink;
+
+/**
+ * 処理を繰り返し実行して1回あたりの時間を計測する
+ * 計測時間がtime_limitを超えるまで繰り返し回数を倍にしていく
+ * @param time_limit 計測時間の目安(ms)
+ * @param func 計測する処理(戻り値は捨てられる)
+ */
+template <class FUNC>
+MEASUREMENT measure(ll time_limit, FUNC func){
+  MEASUREMENT result;
+  ll repeat = 1;
+
+  // 1回目は初回の確保などを除くために捨てる
+  g_sink = func();
+
+  while(true){
+    ll allocation_count = g_allocation_count;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    for(ll i = 0; i < repeat; i++){
+      g_sink = func();
+    }
+
+    double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+    if(elapsed >= time_limit * 1e6 || repeat >= (1LL << 40)){
+      result.op_count = repeat;
+      result.ns_per_op = elapsed / repeat;
+      result.allocations_per_op = (double)(g_allocation_count - allocation_count) / repeat;
+      return result;
+    }
+
+    repeat *= 2;
+  }
+}
+
+/**
+ * 計測結果を出力する
+ */
+void report(const string &board, const string &kernel, const MEASUREMENT &m, double nodes_per_sec = -1.0){
+  printf("{\"board\": \"%s\", \"kernel\": \"%s\", \"ops\": %lld, \"ns_per_op\": %.2f, \"allocs_per_op\": %.3f",
+      board.c_str(), kernel.c_str(), m.op_count, m.ns_per_op, m.allocations_per_op);
+  if(nodes_per_sec >= 0.0){
+    printf(", \"nodes_per_sec\": %.0f", nodes_per_sec);
+  }
+  printf("}\n");
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[]){
+  ll time_limit = 300;
+
+  for(int i = 1; i+1 < argc; i += 2){
+    if(string(argv[i]) == "-time"){
+      time_limit = atoll(argv[i+1]);
+    }
+  }
+
+  // 大きさごとに固定の盤面を使う
+  const int size_list[3] = {20, 40, 60};
+
+  for(int k = 0; k < 3; k++){
+    int size = size_list[k];
+    string board = int2string(size) + "x" + int2string(size);
+    INSTANCE instance = GENERATOR::generate(1000 + size, size);
+
+    RollingBalls *rb = new RollingBalls();
+    rb->init(instance.start, instance.target);
+
+    // 全てのボールを4方向に転がす(1回の転がしあたりの時間に直す)
+    MEASUREMENT m = measure(time_limit, [&]{
+      ll sum = 0;
+      for(int ball_id = 0; ball_id < rb->g_total_ball_count; ball_id++){
+        BALL *ball = rb->get_ball(ball_id);
+        for(int direct = 0; direct < 4; direct++){
+          COORD coord = rb->roll_ball(ball->y, ball->x, direct);
+          sum += coord.y + coord.x;
+        }
+      }
+      return sum;
+    });
+    int roll_count = rb->g_total_ball_count * 4;
+    m.op_count *= roll_count;
+    m.ns_per_op /= roll_count;
+    m.allocations_per_op /= roll_count;
+    report(board, "roll_ball", m);
+
+    // 同じインスタンスで同じ盤面を初期化し直す(2回目以降はメモリ確保が起きないはず)
+    report(board, "init", measure(time_limit, [&]{
+      rb->init(instance.start, instance.target);
+      return (ll)rb->g_board_score;
+    }));
+
+    report(board, "update_eval_field", measure(time_limit, [&]{
+      rb->update_eval_field();
+      return (ll)rb->g_eval_field[0][0];
+    }));
+
+    // 盤面全体の走査は使える実装ごとに計測する(名前に実装を付ける)
+    int default_kernel = rb->g_board_kernel;
+    for(int kernel = 0; kernel < BOARD_KERNEL_COUNT; kernel++){
+      if(!is_board_kernel_supported(kernel)) continue;
+      rb->g_board_kernel = kernel;
+      string suffix = string("/") + BOARD_KERNEL_NAME[kernel];
+
+      report(board, "get_score" + suffix, measure(time_limit, [&]{
+        return (ll)rb->get_score();
+      }));
+
+      report(board, "get_eval" + suffix, measure(time_limit, [&]{
+        return (ll)rb->get_eval();
+      }));
+
+      report(board, "get_zoblish_hash" + suffix, measure(time_limit, [&]{
+        return rb->get_zoblish_hash();
+      }));
+    }
+    rb->g_board_kernel = default_kernel;
+
+    rb->g_generated_node_count = 0;
+    m = measure(time_limit, [&]{
+      QUERY query = rb->beam_search();
+      return (ll)query.ball_id;
+    });
+    // 捨てた1回目の分も含めて割る
+    double nodes_per_call = (double)rb->g_generated_node_count / (m.op_count + 1);
+    report(board, "beam_search", m, nodes_per_call / (m.ns_per_op * 1e-9));
+
+    delete rb;
+  }
+
+  return 0;
+}
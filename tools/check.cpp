@@ -0,0 +1,559 @@
+/**
+ * ソルバーの高速化した処理が素直な実装と同じ結果になるかを調べる
+ *
+ * 使い方:
+ *   ./RollingBallsCheck [-seed S] [-count N]
+ *
+ *   -seed S    乱数と問題のシード値
+ *   -count N   調べる盤面(問題)の数
+ *
+ * 次の項目を調べて、項目ごとに結果を1行ずつ出力する(1つでも合わなければ終了コードは1)。
+ *   count_target_cells/<実装>, sum_eval_planes/<実装>, xor_zoblish/<実装>
+ *     盤面全体を走査する処理のCPUで使える全ての実装が、ランダムな盤面でスカラーの実装と一致する
+ *   incremental board state
+ *     roll()で差分更新している盤面のスコア、評価値、公式のスコアとハッシュ値が最初から計算し直したものと一致する
+ *   board kernels on rolled boards
+ *     転がした盤面でも、盤面全体を走査する処理の全ての実装がスカラーの実装と一致する
+ *   incremental ball index
+ *     転がすたびに更新しているボールの分類が、索引を作り直したものと一致する
+ *   ASSIGNMENT::solve (warm start), ASSIGNMENT::update_row
+ *     初期解を使った solve と1行だけの修正が、ポテンシャルを0から始めて全ての行の増加路を探した割当と同じ費用になる
+ *   wall-only target distance
+ *     割当の費用に使う、壁だけを考えた目標地点ごとの転がす回数が素直に求めたものと一致する
+ *   assignment on rolled boards
+ *     転がした盤面で、色ごとの割当がボールの今の位置から計算し直した費用で最適になっている
+ *   eval field and roll distance
+ *     初期化で作る色ごとの転がす回数と評価用のフィールドが、スレッド数によらず素直に求めたものと一致する
+ *   grow threads on a reused instance
+ *     1つのインスタンスでスレッド数を増やしたり減らしたりしながら続けて解いても、正しい回答を返す
+ */
+#define ROLLING_BALLS_LIBRARY
+#include "../RollingBalls.cpp"
+#include "runner.h"
+
+#include <random>
+
+// 不一致が見つかった項目の数
+int g_failure_count = 0;
+
+/**
+ * 1項目の結果を出力する
+ * @param name 項目の名前
+ * @param case_count 調べた数
+ * @param mismatch_count 一致しなかった数
+ */
+void report(const string &name, int case_count, int mismatch_count){
+  printf("%-40s %s (%d cases, %d mismatches)\n", name.c_str(), (mismatch_count == 0)? "ok" : "NG", case_count, mismatch_count);
+  if(mismatch_count > 0) g_failure_count += 1;
+}
+
+/**
+ * 盤面全体を走査する処理を実装ごとにスカラーと比べる
+ *   セルの数を1からMAX_CELLまでばらばらにして、ベクトルの端数の処理も調べる
+ */
+void check_board_kernels(mt19937_64 &rng, int count){
+  // 配列が大きいのでスタックには置かない
+  BOARD_BYTES *maze = new BOARD_BYTES[1];
+  BOARD_BYTES *target = new BOARD_BYTES[1];
+  EVAL_PLANES *eval_field = new EVAL_PLANES[1];
+  ZOBLISH_TABLE *table = new ZOBLISH_TABLE[1];
+
+  for(int z = 0; z < MAX_CELL; z++){
+    for(int status = 0; status < MAX_STATUS; status++){
+      (*table)[z][status] = rng();
+    }
+  }
+
+  for(int kernel = BOARD_KERNEL_SCALAR + 1; kernel < BOARD_KERNEL_COUNT; kernel++){
+    if(!is_board_kernel_supported(kernel)){
+      printf("%-40s skipped (not supported by this CPU)\n", BOARD_KERNEL_NAME[kernel]);
+      continue;
+    }
+
+    int score_mismatch = 0;
+    int eval_mismatch = 0;
+    int hash_mismatch = 0;
+
+    for(int i = 0; i < count; i++){
+      int cell_count = 1 + rng() % MAX_CELL;
+      int color_count = 1 + rng() % 10;
+
+      for(int z = 0; z < MAX_CELL; z++){
+        // ボール、壁、空白が同じくらい出るようにする
+        int r = rng() % (color_count + 2);
+        (*maze)[z] = (r < color_count)? r : (r == color_count)? WALL : EMPTY;
+        r = rng() % (color_count + 2);
+        (*target)[z] = (r < color_count)? r : (r == color_count)? WALL : EMPTY;
+        for(int color = 0; color < 10; color++){
+          (*eval_field)[color][z] = (int)(rng() % 2001) - 1000;
+        }
+      }
+
+      int match_count, ball_count, expected_match_count, expected_ball_count;
+      count_target_cells(BOARD_KERNEL_SCALAR, *maze, *target, cell_count, expected_match_count, expected_ball_count);
+      count_target_cells(kernel, *maze, *target, cell_count, match_count, ball_count);
+      score_mismatch += (match_count != expected_match_count || ball_count != expected_ball_count);
+
+      eval_mismatch += sum_eval_planes(kernel, *maze, *eval_field, cell_count, color_count)
+        != sum_eval_planes(BOARD_KERNEL_SCALAR, *maze, *eval_field, cell_count, color_count);
+
+      hash_mismatch += xor_zoblish(kernel, *maze, *table, cell_count)
+        != xor_zoblish(BOARD_KERNEL_SCALAR, *maze, *table, cell_count);
+    }
+
+    report(string("count_target_cells/") + BOARD_KERNEL_NAME[kernel], count, score_mismatch);
+    report(string("sum_eval_planes/") + BOARD_KERNEL_NAME[kernel], count, eval_mismatch);
+    report(string("xor_zoblish/") + BOARD_KERNEL_NAME[kernel], count, hash_mismatch);
+  }
+
+  delete[] maze;
+  delete[] target;
+  delete[] eval_field;
+  delete[] table;
+}
+
+/**
+ * 生成した問題ごとにランダムなボールをランダムな方向に転がしていき、25回ごとにcheckを呼ぶ
+ * @param seed 最初の問題のシード値
+ * @param count 問題の数
+ * @param check 転がした後の盤面を調べる処理(一致しなかった場合はtrueを返す)
+ * @param mismatch_count 一致しなかった数
+ * @return checkを呼んだ回数
+ */
+template<class CHECK>
+int roll_randomly(ll seed, int count, CHECK check, int &mismatch_count){
+  const int roll_count = 500;
+  int check_count = 0;
+  mismatch_count = 0;
+
+  for(int i = 0; i < count; i++){
+    INSTANCE instance = GENERATOR::generate(seed + i);
+    RollingBalls *rb = new_solver(0);
+    rb->g_random_seed = seed + i;
+    rb->init(instance.start, instance.target);
+
+    for(int step = 1; step <= roll_count; step++){
+      int ball_id = rb->xor128() % rb->g_total_ball_count;
+      BALL *ball = rb->get_ball(ball_id);
+      rb->roll(ball_id, ball->y, ball->x, rb->xor128() % 4);
+
+      // 全ての手で調べると時間がかかるので間引く
+      if(step % 25 != 0) continue;
+      check_count += 1;
+      mismatch_count += check(rb);
+    }
+
+    delete rb;
+  }
+
+  return check_count;
+}
+
+/**
+ * roll()で差分更新している盤面のスコア、評価値、公式のスコアとハッシュ値を、
+ * スカラーの実装で最初から計算し直したものと比べる
+ */
+void check_incremental_state(ll seed, int count){
+  int mismatch_count;
+  int check_count = roll_randomly(seed, count, [&](RollingBalls *rb){
+    int kernel = rb->g_board_kernel;
+    rb->g_board_kernel = BOARD_KERNEL_SCALAR;
+    bool mismatch = (rb->g_board_score != rb->get_score() || rb->g_board_eval != rb->get_eval()
+        || rb->g_board_point != rb->get_point_total() || rb->g_board_hash != rb->get_zoblish_hash());
+    rb->g_board_kernel = kernel;
+
+    return mismatch;
+  }, mismatch_count);
+
+  report("incremental board state", check_count, mismatch_count);
+}
+
+/**
+ * ランダムに転がした盤面で、盤面全体を走査する処理を全ての実装で計算し直してスカラーと比べる
+ */
+void check_rolled_board_kernels(ll seed, int count){
+  int mismatch_count;
+  int check_count = roll_randomly(seed, count, [&](RollingBalls *rb){
+    int kernel = rb->g_board_kernel;
+    rb->g_board_kernel = BOARD_KERNEL_SCALAR;
+    int score = rb->get_score();
+    int eval = rb->get_eval();
+    ll hash = rb->get_zoblish_hash();
+    bool mismatch = false;
+
+    for(int other = BOARD_KERNEL_SCALAR + 1; other < BOARD_KERNEL_COUNT; other++){
+      if(!is_board_kernel_supported(other)) continue;
+      rb->g_board_kernel = other;
+      mismatch = mismatch || (rb->get_score() != score || rb->get_eval() != eval || rb->get_zoblish_hash() != hash);
+    }
+    rb->g_board_kernel = kernel;
+
+    return mismatch;
+  }, mismatch_count);
+
+  report("board kernels on rolled boards", check_count, mismatch_count);
+}
+
+/**
+ * 転がすたびに更新しているボールの分類と空いている目標地点の数を、索引を作り直したものと比べる
+ */
+void check_ball_index(ll seed, int count){
+  int mismatch_count;
+  int check_count = roll_randomly(seed, count, [&](RollingBalls *rb){
+    vector<int> ball_class = rb->g_ball_index.ball_class;
+    vector<int> open_target_count = rb->g_open_target_count;
+    rb->init_ball_index();
+
+    return ball_class != rb->g_ball_index.ball_class || open_target_count != rb->g_open_target_count;
+  }, mismatch_count);
+
+  report("incremental ball index", check_count, mismatch_count);
+}
+
+/**
+ * 割当の費用の合計(不正な割当の場合は-1)
+ */
+int get_assignment_cost(const ASSIGNMENT &assignment){
+  vector<char> used(assignment.size + 1, false);
+  int cost = 0;
+
+  for(int col = 1; col <= assignment.size; col++){
+    int row = assignment.owner[col];
+    if(row < 1 || row > assignment.size || used[row]) return -1;
+
+    used[row] = true;
+    cost += assignment.cost[row][col];
+  }
+
+  return cost;
+}
+
+/**
+ * ポテンシャルを0から始めて全ての行の増加路を探す(最適な割当の基準)
+ */
+int solve_cold(ASSIGNMENT assignment){
+  fill(assignment.u.begin(), assignment.u.end(), 0);
+  fill(assignment.v.begin(), assignment.v.end(), 0);
+  fill(assignment.owner.begin(), assignment.owner.end(), 0);
+
+  for(int row = 1; row <= assignment.size; row++){
+    assignment.augment(row);
+  }
+
+  return get_assignment_cost(assignment);
+}
+
+/**
+ * solve と update_row の割当の費用を基準と比べる
+ *   費用の幅が狭い場合は同じ費用の割当が多くなるので、いくつかの幅で調べる
+ */
+void check_assignment(mt19937_64 &rng, int count){
+  const int cost_range_list[3] = {3, 20, 100};
+  int solve_mismatch = 0;
+  int update_mismatch = 0;
+  int update_count = 0;
+
+  for(int i = 0; i < count; i++){
+    int size = 1 + rng() % 40;
+    int cost_range = cost_range_list[i % 3];
+    ASSIGNMENT assignment;
+    assignment.init(size);
+
+    for(int row = 1; row <= size; row++){
+      for(int col = 1; col <= size; col++){
+        assignment.cost[row][col] = rng() % cost_range;
+      }
+    }
+
+    assignment.solve();
+    int cost = get_assignment_cost(assignment);
+    solve_mismatch += (cost < 0 || cost != solve_cold(assignment));
+
+    for(int k = 0; k < 10; k++){
+      int row = 1 + rng() % size;
+      for(int col = 1; col <= size; col++){
+        assignment.cost[row][col] = rng() % cost_range;
+      }
+      assignment.update_row(row);
+
+      cost = get_assignment_cost(assignment);
+      update_mismatch += (cost < 0 || cost != solve_cold(assignment));
+      update_count += 1;
+    }
+  }
+
+  report("ASSIGNMENT::solve (warm start)", count, solve_mismatch);
+  report("ASSIGNMENT::update_row", update_count, update_mismatch);
+}
+
+/**
+ * 壁だけを障害物として、全てのセルから4方向に転がした時に止まるセルを素直に求めて、辺を逆向きにした一覧を作る
+ * @param rb 初期化したソルバー
+ * @return セルごとに、1回転がすとそのセルで止まるセルの一覧
+ */
+vector<vector<int> > get_reverse_roll_graph(RollingBalls *rb){
+  vector<vector<int> > graph(rb->g_cell_count);
+
+  for(int y = 0; y < rb->g_height; y++){
+    for(int x = 0; x < rb->g_width; x++){
+      if(rb->g_maze[rb->getZ(y, x)] == WALL) continue;
+
+      for(int direct = 0; direct < 4; direct++){
+        int ny = y;
+        int nx = x;
+
+        while(true){
+          int ty = ny + DY[direct];
+          int tx = nx + DX[direct];
+          if(ty < 0 || rb->g_height <= ty || tx < 0 || rb->g_width <= tx || rb->g_maze[rb->getZ(ty, tx)] == WALL) break;
+          ny = ty;
+          nx = tx;
+        }
+
+        if(ny != y || nx != x) graph[rb->getZ(ny, nx)].push_back(rb->getZ(y, x));
+      }
+    }
+  }
+
+  return graph;
+}
+
+/**
+ * 目標のセルのどれかまで転がす最小回数を、逆向きの辺を幅優先探索で辿って求める
+ * @param graph get_reverse_roll_graphで作った一覧
+ * @param goal_list 目標のセルの一覧
+ * @return セルごとの回数(届かない場合はUNREACHABLE)
+ */
+vector<int> get_roll_distance(const vector<vector<int> > &graph, const vector<int> &goal_list){
+  vector<int> distance(graph.size(), UNREACHABLE);
+  queue<int> que;
+
+  for(int i = 0; i < goal_list.size(); i++){
+    distance[goal_list[i]] = 0;
+    que.push(goal_list[i]);
+  }
+
+  while(!que.empty()){
+    int z = que.front(); que.pop();
+
+    for(int i = 0; i < graph[z].size(); i++){
+      int nz = graph[z][i];
+      if(distance[nz] != UNREACHABLE) continue;
+
+      distance[nz] = distance[z] + 1;
+      que.push(nz);
+    }
+  }
+
+  return distance;
+}
+
+/**
+ * 割当の費用に使う、壁だけを考えた目標地点ごとの転がす回数を素直に求めたものと比べる
+ *   目標地点が多いと時間がかかるので、1問あたり20個くらいに間引く
+ */
+void check_target_distance(ll seed, int count){
+  int mismatch_count = 0;
+  int case_count = 0;
+
+  for(int i = 0; i < count; i++){
+    INSTANCE instance = GENERATOR::generate(seed + i);
+    RollingBalls *rb = new_solver(0);
+    rb->init(instance.start, instance.target);
+
+    vector<vector<int> > graph = get_reverse_roll_graph(rb);
+    int target_count = rb->g_target_list.size();
+
+    for(int target_id = 0; target_id < target_count; target_id += max(1, target_count / 20)){
+      TARGET *target = rb->get_target(target_id);
+      vector<int> distance = get_roll_distance(graph, vector<int>(1, rb->getZ(target->y, target->x)));
+      bool mismatch = false;
+
+      for(int y = 0; y < rb->g_height; y++){
+        for(int x = 0; x < rb->g_width; x++){
+          int z = rb->getZ(y, x);
+          if(rb->g_maze[z] == WALL) continue;
+          mismatch = mismatch || rb->g_target_distance[target_id * rb->g_cell_count + z] != distance[z];
+        }
+      }
+
+      mismatch_count += mismatch;
+      case_count += 1;
+    }
+
+    delete rb;
+  }
+
+  report("wall-only target distance", case_count, mismatch_count);
+}
+
+/**
+ * ランダムに転がした盤面で、色ごとの割当を調べる
+ *   費用がボールの今の位置から計算し直したものと一致し、割当が最適な割当と同じ費用で、
+ *   各ボールの目標地点が割当の通りになっていること
+ */
+void check_board_assignment(ll seed, int count){
+  int mismatch_count;
+  int check_count = roll_randomly(seed, count, [&](RollingBalls *rb){
+    bool mismatch = false;
+
+    for(int color = 0; color < rb->g_color_count; color++){
+      const ASSIGNMENT &assignment = rb->g_assignment_list[color];
+
+      for(int row = 1; row <= assignment.size; row++){
+        int ball_id = assignment.ball_ids[row];
+
+        for(int col = 1; col <= assignment.size; col++){
+          int target_id = assignment.target_ids[col];
+          int expected_cost = 0;
+
+          if(ball_id != UNKNOWN && target_id != UNKNOWN){
+            BALL *ball = rb->get_ball(ball_id);
+            expected_cost = rb->get_target_dist(target_id, ball->y, ball->x);
+          }
+          mismatch = mismatch || assignment.cost[row][col] != expected_cost;
+        }
+      }
+
+      int cost = get_assignment_cost(assignment);
+      mismatch = mismatch || cost < 0 || cost != solve_cold(assignment);
+
+      for(int col = 1; col <= assignment.size; col++){
+        int ball_id = assignment.ball_ids[assignment.owner[col]];
+        if(ball_id == UNKNOWN) continue;
+        mismatch = mismatch || rb->get_ball(ball_id)->target_id != assignment.target_ids[col];
+      }
+    }
+
+    return mismatch;
+  }, mismatch_count);
+
+  report("assignment on rolled boards", check_count, mismatch_count);
+}
+
+/**
+ * 初期化で作る色ごとの転がす回数と評価用のフィールドを、素直に求めたものと比べる
+ *   転がす回数はスレッドごとに別の色を受け持って求めるので、1つのインスタンスでスレッド数を変えて調べる
+ */
+void check_eval_field(ll seed, int count){
+  const int thread_count_list[2] = {1, 3};
+  int mismatch_count = 0;
+  int case_count = 0;
+  RollingBalls *rb = new_solver(0);
+
+  for(int i = 0; i < count; i++){
+    INSTANCE instance = GENERATOR::generate(seed + i);
+
+    for(int k = 0; k < 2; k++){
+      rb->g_thread_count = thread_count_list[k];
+      rb->init(instance.start, instance.target);
+
+      vector<vector<int> > graph = get_reverse_roll_graph(rb);
+      bool mismatch = false;
+
+      for(int color = 0; color < 10; color++){
+        vector<int> goal_list;
+        vector<int> field(rb->g_cell_count, 0);
+
+        for(int y = 0; y < rb->g_height; y++){
+          for(int x = 0; x < rb->g_width; x++){
+            if(rb->g_target[rb->getZ(y, x)] != color) continue;
+            goal_list.push_back(rb->getZ(y, x));
+            field[rb->getZ(y, x)] += 100;
+
+            // 空白を通って2マス先までの経路ごとに、1マス目は2、2マス目は1を足す
+            for(int direct = 0; direct < 4; direct++){
+              int ny = y + DY[direct];
+              int nx = x + DX[direct];
+              if(ny < 0 || rb->g_height <= ny || nx < 0 || rb->g_width <= nx || rb->g_maze[rb->getZ(ny, nx)] != EMPTY) continue;
+              field[rb->getZ(ny, nx)] += 2;
+
+              for(int next_direct = 0; next_direct < 4; next_direct++){
+                int nny = ny + DY[next_direct];
+                int nnx = nx + DX[next_direct];
+                if(nny < 0 || rb->g_height <= nny || nnx < 0 || rb->g_width <= nnx || rb->g_maze[rb->getZ(nny, nnx)] != EMPTY) continue;
+                field[rb->getZ(nny, nnx)] += 1;
+              }
+            }
+          }
+        }
+
+        vector<int> distance = get_roll_distance(graph, goal_list);
+
+        for(int y = 0; y < rb->g_height; y++){
+          for(int x = 0; x < rb->g_width; x++){
+            int z = rb->getZ(y, x);
+            if(0 < distance[z] && distance[z] <= rb->g_roll_distance_limit){
+              field[z] += 4 * (rb->g_roll_distance_limit - distance[z] + 1);
+            }
+
+            mismatch = mismatch || rb->g_roll_distance[z][color] != distance[z] || rb->g_eval_field[color][z] != field[z];
+          }
+        }
+      }
+
+      mismatch_count += mismatch;
+      case_count += 1;
+    }
+  }
+
+  delete rb;
+  report("eval field and roll distance", case_count, mismatch_count);
+}
+
+/**
+ * 1つのインスタンスを使い回して、スレッド数を変えながら問題を解く
+ *   スレッドを増やした時に前の問題の処理を新しいスレッドが実行しないことを調べる
+ */
+void check_reused_instance(ll seed, int count){
+  const int thread_count_list[5] = {2, 4, 1, 3, 4};
+  int invalid_count = 0;
+  int case_count = 0;
+  RollingBalls *rb = new_solver(50);
+
+  for(int i = 0; i < count; i++){
+    INSTANCE instance = GENERATOR::generate(seed + i);
+
+    for(int k = 0; k < 5; k++){
+      rb->g_thread_count = thread_count_list[k];
+      invalid_count += !solve_with(rb, instance).valid;
+      case_count += 1;
+    }
+  }
+
+  delete rb;
+  report("grow threads on a reused instance", case_count, invalid_count);
+}
+
+int main(int argc, char *argv[]){
+  ll seed = 1;
+  int count = 30;
+
+  for(int i = 1; i+1 < argc; i += 2){
+    string option = argv[i];
+
+    if(option == "-seed"){
+      seed = atoll(argv[i+1]);
+    }else if(option == "-count"){
+      count = max(1, atoi(argv[i+1]));
+    }else{
+      fprintf(stderr, "unknown option %s\n", option.c_str());
+      return 1;
+    }
+  }
+
+  mt19937_64 rng(seed);
+  // 乱数の盤面と割当は1つが軽いので問題の数より多く調べる
+  check_board_kernels(rng, count * 100);
+  check_incremental_state(seed, count);
+  check_rolled_board_kernels(seed, count);
+  check_ball_index(seed, count);
+  check_assignment(rng, count * 100);
+  check_target_distance(seed, count);
+  check_board_assignment(seed, count);
+  check_eval_field(seed, count);
+  // 1問を解くのに時間がかかるので問題の数を減らす
+  check_reused_instance(seed, max(1, count / 10));
+
+  return (g_failure_count == 0)? 0 : 1;
+}
@@ -0,0 +1,60 @@
+/**
+ * 問題の生成を行う(Javaを使わずにベンチマーク用の問題を用意する)
+ *
+ * 使い方:
+ *   ./RollingBallsGenerator -seed 1 -count 1000 [-size 60] [-dir cases]
+ *
+ *   -seed S    最初のシード値
+ *   -count N   生成する問題の数(シード値は S, S+1, ..., S+N-1)
+ *   -size L    盤面の大きさを L x L に固定する(指定しない場合はランダム)
+ *   -dir DIR   DIR/<seed>.txt に1問ずつ書き出す(指定しない場合は標準出力に連結して書き出す)
+ *
+ * 標準出力に書き出したものはそのまま RollingBallsBatch の標準入力に渡せる。
+ */
+#define ROLLING_BALLS_LIBRARY
+#include "../RollingBalls.cpp"
+#include "generator.h"
+
+#include <fstream>
+#include <filesystem>
+
+int main(int argc, char *argv[]){
+  ll seed = 1;
+  int count = 1;
+  int size = 0;
+  string dir = "";
+
+  for(int i = 1; i+1 < argc; i += 2){
+    string option = argv[i];
+
+    if(option == "-seed"){
+      seed = atoll(argv[i+1]);
+    }else if(option == "-count"){
+      count = atoi(argv[i+1]);
+    }else if(option == "-size"){
+      size = atoi(argv[i+1]);
+    }else if(option == "-dir"){
+      dir = argv[i+1];
+    }else{
+      fprintf(stderr, "unknown option %s\n", option.c_str());
+      return 1;
+    }
+  }
+
+  if(!dir.empty()){
+    filesystem::create_directories(dir);
+  }
+
+  for(int i = 0; i < count; i++){
+    INSTANCE instance = GENERATOR::generate(seed + i, size);
+
+    if(dir.empty()){
+      write_instance(cout, instance);
+    }else{
+      ofstream out(dir + "/" + to_string(seed + i) + ".txt");
+      write_instance(out, instance);
+    }
+  }
+
+  return 0;
+}
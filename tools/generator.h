@@ -0,0 +1,195 @@
+/**
+ * ビジュアライザ(RollingBallsVis)と同じ手順で問題を生成する
+ *
+ *   1. H, W を [10, 60]、色の数 C を [1, 10]、壁の割合を [10, 30]%、ボールの割合を [8, 20]% から選ぶ
+ *      (seed が 1, 2 の場合は H = W = 10 * seed, C = seed)
+ *   2. 各セルを壁、ボール、空白のいずれかにして目標盤面を作る(ボールが1つもなければやり直す)
+ *   3. ランダムなボールを [3, 13) * (ボールの数) 回だけ転がしたものを初期盤面にする
+ *   4. 同じ色の目標地点に残っているボールはもう一度転がす
+ *
+ * 乱数はJavaのSHA1PRNGではないので、同じseedでもビジュアライザと同じ問題にはならない。
+ * RollingBalls.cpp の後に読み込むこと。
+ */
+#ifndef ROLLING_BALLS_GENERATOR_H
+#define ROLLING_BALLS_GENERATOR_H
+
+#include <random>
+
+// 問題
+struct INSTANCE {
+  string name;
+  vector<string> start;
+  vector<string> target;
+};
+
+class GENERATOR {
+  public:
+    // 盤面の大きさ
+    static constexpr int MIN_SIZE = 10;
+    static constexpr int MAX_SIZE = 60;
+    // 壁の割合(%)
+    static constexpr int MIN_WALLS_P = 10;
+    static constexpr int MAX_WALLS_P = 30;
+    // ボールの割合(%)
+    static constexpr int MIN_BALLS_P = 8;
+    static constexpr int MAX_BALLS_P = 20;
+
+    GENERATOR(unsigned long long seed) : rng(seed) {
+    }
+
+    /**
+     * 問題を生成する
+     * @param seed シード値
+     * @param size 盤面の大きさ(0の場合はランダム)
+     * @return 生成した問題
+     */
+    static INSTANCE generate(unsigned long long seed, int size = 0){
+      GENERATOR generator(seed);
+      return generator.build(seed, size);
+    }
+
+  private:
+    mt19937_64 rng;
+    vector<string> maze;
+    int height;
+    int width;
+
+    /**
+     * [0, n) の乱数
+     */
+    int next_int(int n){
+      return rng() % n;
+    }
+
+    INSTANCE build(unsigned long long seed, int size){
+      INSTANCE instance;
+      instance.name = "seed:" + to_string(seed);
+
+      height = next_int(MAX_SIZE - MIN_SIZE + 1) + MIN_SIZE;
+      width = next_int(MAX_SIZE - MIN_SIZE + 1) + MIN_SIZE;
+      int color_count = next_int(10) + 1;
+
+      if(seed == 1 || seed == 2){
+        height = width = MIN_SIZE * seed;
+        color_count = seed;
+      }
+      if(size > 0){
+        height = width = min(size, MAX_SIZE);
+      }
+
+      int walls_p = next_int(MAX_WALLS_P - MIN_WALLS_P + 1) + MIN_WALLS_P;
+      int balls_p = next_int(MAX_BALLS_P - MIN_BALLS_P + 1) + MIN_BALLS_P;
+      int ball_count;
+
+      // 目標盤面を作る
+      do {
+        ball_count = 0;
+        maze.assign(height, string(width, '.'));
+
+        for(int y = 0; y < height; y++){
+          for(int x = 0; x < width; x++){
+            if(next_int(100) < walls_p){
+              maze[y][x] = '#';
+            }else if(next_int(100) < balls_p){
+              maze[y][x] = '0' + next_int(color_count);
+              ball_count += 1;
+            }
+          }
+        }
+      }while(ball_count == 0);
+
+      instance.target = maze;
+
+      vector<COORD> ball_list;
+      for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+          if(isdigit(maze[y][x])) ball_list.push_back(COORD(y, x));
+        }
+      }
+
+      // ランダムに転がして初期盤面を作る
+      int roll_count = next_int(ball_count * 10) + ball_count * 3;
+      for(int i = 0; i < roll_count; i++){
+        int ball_id = next_int(ball_count);
+        int direct = choose_roll(ball_list[ball_id]);
+
+        if(direct != UNKNOWN){
+          ball_list[ball_id] = roll(ball_list[ball_id], direct);
+        }
+      }
+
+      // 同じ色の目標地点に残っているボールは動かす
+      for(int ball_id = 0; ball_id < ball_count; ball_id++){
+        COORD &ball = ball_list[ball_id];
+        char ch = instance.target[ball.y][ball.x];
+
+        if(ch == maze[ball.y][ball.x] && ch != '.' && ch != '#'){
+          int direct = choose_roll(ball);
+
+          if(direct != UNKNOWN){
+            ball = roll(ball, direct);
+          }
+        }
+      }
+
+      instance.start = maze;
+
+      return instance;
+    }
+
+    /**
+     * 1マス以上転がせる方向をランダムに選ぶ
+     * @return 方向(転がせない場合はUNKNOWN)
+     */
+    int choose_roll(const COORD &ball){
+      int allowed[4];
+      int allowed_count = 0;
+
+      for(int direct = 0; direct < 4; direct++){
+        int ny = ball.y + DY[direct];
+        int nx = ball.x + DX[direct];
+
+        if(0 <= ny && ny < height && 0 <= nx && nx < width && maze[ny][nx] == '.'){
+          allowed[allowed_count++] = direct;
+        }
+      }
+
+      if(allowed_count == 0) return UNKNOWN;
+
+      return allowed[next_int(allowed_count)];
+    }
+
+    /**
+     * ボールを転がす
+     * @return 転がした後の位置
+     */
+    COORD roll(const COORD &ball, int direct){
+      int ny = ball.y;
+      int nx = ball.x;
+
+      while(true){
+        int ty = ny + DY[direct];
+        int tx = nx + DX[direct];
+
+        if(ty < 0 || height <= ty || tx < 0 || width <= tx || maze[ty][tx] != '.') break;
+        ny = ty;
+        nx = tx;
+      }
+
+      swap(maze[ball.y][ball.x], maze[ny][nx]);
+
+      return COORD(ny, nx);
+    }
+};
+
+/**
+ * 問題をRollingBalls.cppのmainの入力と同じ形式で書き出す
+ */
+void write_instance(ostream &out, const INSTANCE &instance){
+  out << instance.start.size() << "\n";
+  for(int y = 0; y < instance.start.size(); y++) out << instance.start[y] << "\n";
+  out << instance.target.size() << "\n";
+  for(int y = 0; y < instance.target.size(); y++) out << instance.target[y] << "\n";
+}
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * ツールで共通に使う、問題を解いて回答を確かめる処理と、問題を並列に解く処理
+ *
+ * RollingBalls.cpp の後に読み込むこと。
+ */
+#ifndef ROLLING_BALLS_RUNNER_H
+#define ROLLING_BALLS_RUNNER_H
+
+#include "generator.h"
+
+#include <atomic>
+#include <chrono>
+
+// 1問を解いた結果
+struct RESULT {
+  int height;
+  int width;
+  int ball_count;
+  int move_count;
+  bool valid;
+  double score;
+  double time;
+  double init_time;
+  bool perf_available;
+  SEARCH_STATS stats;
+};
+
+/**
+ * 標準エラー出力に何も書き出さないソルバーを作る(使い終わったらdeleteすること)
+ * @param time_limit 制限時間(ms)
+ * @return ソルバー
+ */
+RollingBalls *new_solver(ll time_limit){
+  // 盤面の配列が大きいのでスタックには置かない
+  RollingBalls *rb = new RollingBalls();
+  rb->g_time_limit = time_limit;
+  rb->g_verbose = false;
+
+  return rb;
+}
+
+/**
+ * 設定済みのソルバーで1問解いて、初期盤面から回答を再生してスコアを計算する
+ * @param rb ソルバー
+ * @param instance 問題
+ * @return 結果
+ */
+RESULT solve_with(RollingBalls *rb, const INSTANCE &instance){
+  RESULT result;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<string> query_list = rb->restorePattern(instance.start, instance.target);
+  chrono::steady_clock::time_point end = chrono::steady_clock::now();
+
+  result.height = rb->g_height;
+  result.width = rb->g_width;
+  result.ball_count = rb->g_total_ball_count;
+  VERDICT verdict = simulate(instance.start, instance.target, query_list);
+  result.move_count = query_list.size();
+  result.valid = verdict.valid;
+  result.score = verdict.score;
+
+  if(!verdict.valid){
+    fprintf(stderr, "%s: invalid answer (%s)\n", instance.name.c_str(), verdict.message.c_str());
+  }
+  result.time = chrono::duration<double, milli>(end - start).count();
+  result.init_time = rb->g_init_time;
+  result.perf_available = rb->g_perf_available;
+  result.stats = rb->g_total_stats;
+
+  return result;
+}
+
+/**
+ * 新しいソルバーで1問解く
+ * @param instance 問題
+ * @param time_limit 制限時間(ms)
+ * @param configure 解く前にソルバーの設定を変える処理
+ * @return 結果
+ */
+template<class CONFIGURE>
+RESULT solve_instance(const INSTANCE &instance, ll time_limit, CONFIGURE configure){
+  RollingBalls *rb = new_solver(time_limit);
+  configure(rb);
+
+  RESULT result = solve_with(rb, instance);
+
+  delete rb;
+  return result;
+}
+
+/**
+ * 0, 1, ..., count-1 番の処理を、空いたスレッドから順番に実行していく
+ * @param count 処理の数
+ * @param thread_count スレッドの数
+ * @param task 番号を受け取って1件分の処理を行う(複数のスレッドから同時に呼ばれる)
+ */
+template<class TASK>
+void run_parallel(int count, int thread_count, TASK task){
+  atomic<int> next_id(0);
+  vector<thread> thread_list;
+
+  for(int thread_id = 0; thread_id < thread_count; thread_id++){
+    thread_list.push_back(thread([&]{
+      for(int id = next_id++; id < count; id = next_id++){
+        task(id);
+      }
+    }));
+  }
+  for(int i = 0; i < thread_list.size(); i++){
+    thread_list[i].join();
+  }
+}
+
+#endif
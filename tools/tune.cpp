@@ -0,0 +1,311 @@
+/**
+ * パラメータを調整するためのドライバ
+ *
+ * 使い方:
+ *   ./RollingBallsTune [-seed S] [-count N] [-candidates K] [-thread N] [-time MS] [-cache FILE] > tune_result.jsonl
+ *
+ *   -seed S         問題のシード値 S, S+1, ..., S+N-1 を使う(generator.h で生成する)
+ *   -count N        問題の数
+ *   -candidates K   調べる設定の数(0番目は現在の設定、残りはランダムに選ぶ)
+ *   -tune_seed S    設定を選ぶ乱数のシード値
+ *   -min_count N    最初の段階で1つの設定を試す問題の数
+ *   -eta E          1つの段階で残す設定の割合の逆数(試す問題の数はE倍にする)
+ *   -thread N       同時に解く問題の数(デフォルトはCPUのコア数)
+ *   -time MS        1問あたりの制限時間(ミリ秒)
+ *   -cache FILE     (設定, 問題のシード値, 制限時間) → スコアを保存するファイル
+ *                   (ソルバーを変更した場合は消すこと)
+ *
+ * 盤面の大きさの区分(small / medium / large)ごとに successive halving を行う。
+ * 各段階では残っている設定を同じ問題で解いて平均スコアの上位 1/E だけを残し、
+ * 次の段階では E 倍の問題で解き直す。区分ごとに一番良かった設定を1行1件のJSONで出力する。
+ */
+#define ROLLING_BALLS_LIBRARY
+#include "../RollingBalls.cpp"
+#include "runner.h"
+
+#include <fstream>
+#include <random>
+#include <unordered_map>
+
+// 調整するパラメータ
+struct TUNABLE {
+  const char *name;
+  int RollingBalls::*field;
+  int min_value;
+  int max_value;
+};
+
+const TUNABLE TUNABLE_LIST[] = {
+  {"beam_range_percent", &RollingBalls::g_beam_range_percent, 50, 200},
+  {"max_beam_depth", &RollingBalls::g_max_beam_depth, 2, 5},
+  {"roll_distance_limit", &RollingBalls::g_roll_distance_limit, 2, 8},
+  {"assignment_weight", &RollingBalls::g_assignment_weight, 0, 5},
+  {"assignment_roll_weight", &RollingBalls::g_assignment_roll_weight, 0, 8},
+  {"main_score", &RollingBalls::g_main_score, 500, 2000},
+  {"sub_score", &RollingBalls::g_sub_score, -1000, 0},
+  {"sub_score_switch", &RollingBalls::g_sub_score_switch, 5, 18},
+};
+const int TUNABLE_COUNT = sizeof(TUNABLE_LIST) / sizeof(TUNABLE_LIST[0]);
+
+// 1つの設定(TUNABLE_LISTの順に値を持つ)
+typedef vector<int> PARAM_SET;
+
+// 解いた結果のキャッシュ
+// ファイルには "キー<TAB>スコア" を1行1件で追記する
+class RESULT_CACHE {
+  public:
+    /**
+     * ファイルから読み込む(ファイル名が空の場合はメモリ上だけで使う)
+     * @param path ファイル名
+     */
+    bool open(const string &path){
+      if(path.empty()) return true;
+
+      ifstream in(path);
+      string line;
+      while(getline(in, line)){
+        size_t tab = line.rfind('\t');
+        if(tab == string::npos) continue;
+        score_map[line.substr(0, tab)] = atof(line.c_str() + tab + 1);
+      }
+
+      output = fopen(path.c_str(), "a");
+      return output != NULL;
+    }
+
+    void close(){
+      if(output != NULL) fclose(output);
+      output = NULL;
+    }
+
+    /**
+     * キーに対応するスコアを探す
+     * @return (true: 見つかった, false: 見つからなかった)
+     */
+    bool find(const string &key, double &score){
+      lock_guard<mutex> lock(mtx);
+      unordered_map<string, double>::iterator it = score_map.find(key);
+      if(it == score_map.end()) return false;
+
+      score = it->second;
+      return true;
+    }
+
+    /**
+     * スコアを保存する(途中で止めても結果が残るように1件ずつ書き出す)
+     */
+    void insert(const string &key, double score){
+      lock_guard<mutex> lock(mtx);
+      score_map[key] = score;
+
+      if(output != NULL){
+        fprintf(output, "%s\t%.17g\n", key.c_str(), score);
+        fflush(output);
+      }
+    }
+
+  private:
+    unordered_map<string, double> score_map;
+    FILE *output = NULL;
+    mutex mtx;
+};
+
+/**
+ * 設定を "name=value,..." の形式にする(キャッシュのキーにも使う)
+ */
+string param_to_string(const PARAM_SET &param){
+  string str;
+
+  for(int i = 0; i < TUNABLE_COUNT; i++){
+    if(i > 0) str += ",";
+    str += string(TUNABLE_LIST[i].name) + "=" + int2string(param[i]);
+  }
+
+  return str;
+}
+
+/**
+ * 1問解いて公式のスコアを返す
+ * @param param 設定
+ * @param instance 問題
+ * @param time_limit 制限時間(ms)
+ * @return スコア(不正な回答の場合は0)
+ */
+double solve(const PARAM_SET &param, const INSTANCE &instance, ll time_limit){
+  return solve_instance(instance, time_limit, [&](RollingBalls *rb){
+    for(int i = 0; i < TUNABLE_COUNT; i++){
+      rb->*TUNABLE_LIST[i].field = param[i];
+    }
+  }).score;
+}
+
+/**
+ * 設定ごとに問題を解いて平均スコアを求める(キャッシュに無いものだけを並列に解く)
+ * @param param_list 設定の一覧
+ * @param candidate_ids 調べる設定の番号
+ * @param instance_list 問題の一覧
+ * @param instance_count 先頭から何問を使うか
+ * @return 設定ごとの平均スコア(candidate_idsの順)
+ */
+vector<double> evaluate(const vector<PARAM_SET> &param_list, const vector<int> &candidate_ids,
+    const vector<INSTANCE> &instance_list, int instance_count, ll time_limit, int thread_count, RESULT_CACHE &cache){
+  vector<string> key_list;
+  vector<int> job_list;
+
+  for(int i = 0; i < candidate_ids.size(); i++){
+    string prefix = int2string(time_limit) + "|" + param_to_string(param_list[candidate_ids[i]]) + "|";
+
+    for(int k = 0; k < instance_count; k++){
+      double score;
+      string key = prefix + instance_list[k].name;
+      key_list.push_back(key);
+      if(!cache.find(key, score)) job_list.push_back(key_list.size() - 1);
+    }
+  }
+
+  run_parallel(job_list.size(), thread_count, [&](int job){
+    int index = job_list[job];
+    int candidate_id = candidate_ids[index / instance_count];
+    const INSTANCE &instance = instance_list[index % instance_count];
+    cache.insert(key_list[index], solve(param_list[candidate_id], instance, time_limit));
+  });
+
+  vector<double> score_list(candidate_ids.size(), 0.0);
+  for(int index = 0; index < key_list.size(); index++){
+    double score = 0.0;
+    cache.find(key_list[index], score);
+    score_list[index / instance_count] += score / instance_count;
+  }
+
+  return score_list;
+}
+
+int main(int argc, char *argv[]){
+  ll seed = 1;
+  int count = 60;
+  int candidate_count = 16;
+  unsigned long long tune_seed = 1;
+  int min_count = 4;
+  int eta = 2;
+  int thread_count = max(1U, thread::hardware_concurrency());
+  ll time_limit = 2000;
+  string cache_path = "";
+
+  for(int i = 1; i < argc; i += 2){
+    string option = argv[i];
+
+    if(i+1 >= argc){
+      fprintf(stderr, "option %s needs a value\n", option.c_str());
+      return 1;
+    }
+
+    if(option == "-seed"){
+      seed = atoll(argv[i+1]);
+    }else if(option == "-count"){
+      count = max(1, atoi(argv[i+1]));
+    }else if(option == "-candidates"){
+      candidate_count = max(1, atoi(argv[i+1]));
+    }else if(option == "-tune_seed"){
+      tune_seed = atoll(argv[i+1]);
+    }else if(option == "-min_count"){
+      min_count = max(1, atoi(argv[i+1]));
+    }else if(option == "-eta"){
+      eta = max(2, atoi(argv[i+1]));
+    }else if(option == "-thread"){
+      thread_count = max(1, atoi(argv[i+1]));
+    }else if(option == "-time"){
+      time_limit = atoll(argv[i+1]);
+    }else if(option == "-cache"){
+      cache_path = argv[i+1];
+    }else{
+      fprintf(stderr, "unknown option %s\n", option.c_str());
+      return 1;
+    }
+  }
+
+  RESULT_CACHE cache;
+  if(!cache.open(cache_path)){
+    fprintf(stderr, "can't open %s\n", cache_path.c_str());
+    return 1;
+  }
+
+  // 0番目は現在の設定
+  vector<PARAM_SET> param_list(candidate_count, PARAM_SET(TUNABLE_COUNT));
+  RollingBalls *defaults = new RollingBalls();
+  mt19937_64 rng(tune_seed);
+  for(int i = 0; i < TUNABLE_COUNT; i++){
+    const TUNABLE &tunable = TUNABLE_LIST[i];
+    param_list[0][i] = defaults->*tunable.field;
+
+    for(int candidate_id = 1; candidate_id < candidate_count; candidate_id++){
+      param_list[candidate_id][i] = tunable.min_value + rng() % (tunable.max_value - tunable.min_value + 1);
+    }
+  }
+  delete defaults;
+
+  // 問題を盤面の大きさの区分ごとに分ける(名前はシード値にしてキャッシュのキーに使う)
+  const char *size_class_list[3] = {"small", "medium", "large"};
+  vector<INSTANCE> class_instance_list[3];
+  for(int i = 0; i < count; i++){
+    INSTANCE instance = GENERATOR::generate(seed + i);
+    instance.name = to_string(seed + i);
+    int cell_count = instance.start.size() * instance.start[0].size();
+
+    for(int k = 0; k < 3; k++){
+      if(string(get_size_class(cell_count)) == size_class_list[k]) class_instance_list[k].push_back(instance);
+    }
+  }
+
+  for(int k = 0; k < 3; k++){
+    const vector<INSTANCE> &instance_list = class_instance_list[k];
+    if(instance_list.empty()) continue;
+
+    vector<int> candidate_ids(candidate_count);
+    for(int i = 0; i < candidate_count; i++) candidate_ids[i] = i;
+    vector<double> score_list;
+    int instance_count = min(min_count, (int)instance_list.size());
+
+    // 設定が1つになるか、全ての問題を使うまで絞り込む
+    while(true){
+      score_list = evaluate(param_list, candidate_ids, instance_list, instance_count, time_limit, thread_count, cache);
+
+      vector<int> order(candidate_ids.size());
+      for(int i = 0; i < order.size(); i++) order[i] = i;
+      stable_sort(order.begin(), order.end(), [&](int a, int b){ return score_list[a] > score_list[b]; });
+
+      vector<int> next_ids;
+      vector<double> next_scores;
+      for(int i = 0; i < order.size(); i++){
+        next_ids.push_back(candidate_ids[order[i]]);
+        next_scores.push_back(score_list[order[i]]);
+      }
+      candidate_ids.swap(next_ids);
+      score_list.swap(next_scores);
+
+      fprintf(stderr, "%s: %d candidates x %d instances, best = #%d (%f)\n",
+          size_class_list[k], (int)candidate_ids.size(), instance_count, candidate_ids[0], score_list[0]);
+
+      if(candidate_ids.size() == 1 || instance_count == instance_list.size()) break;
+
+      candidate_ids.resize((candidate_ids.size() + eta - 1) / eta);
+      score_list.resize(candidate_ids.size());
+      instance_count = min(instance_count * eta, (int)instance_list.size());
+    }
+
+    // 比較のために現在の設定も同じ問題で解く
+    vector<int> default_ids(1, 0);
+    double default_score = evaluate(param_list, default_ids, instance_list, instance_count, time_limit, thread_count, cache)[0];
+
+    printf("{\"size_class\": \"%s\", \"instances\": %d, \"candidate\": %d, \"score\": %.6f, \"default_score\": %.6f, \"params\": {",
+        size_class_list[k], instance_count, candidate_ids[0], score_list[0], default_score);
+    for(int i = 0; i < TUNABLE_COUNT; i++){
+      printf("%s\"%s\": %d", (i > 0)? ", " : "", TUNABLE_LIST[i].name, param_list[candidate_ids[0]][i]);
+    }
+    printf("}}\n");
+    fflush(stdout);
+  }
+
+  cache.close();
+
+  return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * 回答の判定とスコアの計算を行う(ビジュアライザを使わずにスコアを求める)
+ *
+ * 使い方:
+ *   ./RollingBallsValidator case.txt output.txt
+ *   ./RollingBalls < case.txt | ./RollingBallsValidator case.txt
+ *
+ * case.txt はRollingBalls.cppのmainの入力と同じ形式、output.txt はmainの出力と同じ形式。
+ * output.txt を省略した場合は標準入力から読み込む。
+ * analysis.rb で集計できるように "Score = " の形式で出力する。
+ */
+#define ROLLING_BALLS_LIBRARY
+#include "../RollingBalls.cpp"
+
+#include <fstream>
+
+/**
+ * 回答を読み込む
+ * @param in 入力
+ * @param query_list 読み込んだ回答
+ * @return (true: 読み込めた, false: 形式が不正)
+ */
+bool read_answer(istream &in, vector<string> &query_list){
+  int n;
+  string line;
+
+  if(!(in >> n) || n < 0) return false;
+  getline(in, line);
+
+  for(int i = 0; i < n; i++){
+    if(!getline(in, line)) return false;
+    query_list.push_back(line);
+  }
+
+  return true;
+}
+
+int main(int argc, char *argv[]){
+  if(argc < 2){
+    fprintf(stderr, "usage: %s case.txt [output.txt]\n", argv[0]);
+    return 1;
+  }
+
+  ifstream case_file(argv[1]);
+  int h;
+  string str;
+  vector<string> start, target;
+
+  if(!(case_file >> h)){
+    fprintf(stderr, "can't read %s\n", argv[1]);
+    return 1;
+  }
+  for(int i = 0; i < h; i++){ case_file >> str; start.push_back(str); }
+  case_file >> h;
+  for(int i = 0; i < h; i++){ case_file >> str; target.push_back(str); }
+
+  vector<string> query_list;
+  bool readable;
+
+  if(argc >= 3){
+    ifstream answer_file(argv[2]);
+    readable = read_answer(answer_file, query_list);
+  }else{
+    readable = read_answer(cin, query_list);
+  }
+
+  if(!readable){
+    fprintf(stderr, "invalid answer: can't read the answer\n");
+    printf("Score = 0.0\n");
+    return 2;
+  }
+
+  VERDICT verdict = simulate(start, target, query_list);
+
+  if(!verdict.valid){
+    fprintf(stderr, "invalid answer: %s\n", verdict.message.c_str());
+  }
+  fprintf(stderr, "moves = %d\n", verdict.move_count);
+  printf("Score = %f\n", verdict.score);
+
+  return (verdict.valid)? 0 : 2;
+}